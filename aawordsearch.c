@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
@@ -30,6 +31,7 @@
 #include <err.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <stdarg.h>
@@ -39,6 +41,15 @@
 #include <locale.h>
 #include <wchar.h>
 #include <wctype.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
 #ifdef HAVE_CURL
 #include <curl/curl.h>
 #endif
@@ -51,50 +62,246 @@
 #define PROGRAM_NAME "aawordsearch"
 #endif
 
+// None of the alphabets has more letters than this
+#define MAX_ALPHABET_LEN 32
+// lang_vars has tables for the characters below this: ASCII and Latin-1,
+// which have all the letters of the alphabets
+#define LANG_TABLE_SIZE 256
+// The index in lang_vars of a character that isn't in the alphabet
+#define NOT_IN_ALPHABET UINT8_MAX
+
 struct lang_vars
 {
   const char *lang;
-  const char *locale;
   const wchar_t *alphabet;
   const size_t length;
+  // filled in by lang_init(), so words are upper-cased and translated to
+  // letter indexes the same way whatever the locale is
+  wchar_t upper[LANG_TABLE_SIZE];
+  uint8_t index[LANG_TABLE_SIZE];
 };
 
+/*
+ * A connection to a word host that's kept open between fetches (HTTP
+ * keep-alive), so retries and later fetches from the same process skip the
+ * DNS lookup, the TCP connection and the TLS handshake
+ */
+struct fetcher
+{
+  // the host the connection is open to, or NULL if there's none
+  const char *host;
+  // how long a fetch can take, or 0 to wait as long as it takes
+  int timeout_ms;
 #ifdef HAVE_CURL
-struct memory {
- char *response;
- size_t size;
+  // curl keeps the connection in the handle
+  CURL *curl;
+#else
+  int fd;
+  // bytes received from fd that haven't been used yet
+  char in[BUFSIZ];
+  size_t in_start;
+  size_t in_len;
+#endif
 };
 
-static size_t cb(void *data, size_t size, size_t nmemb, void *userp)
+/*
+ * All the words of a list are kept in one pool, each one NUL terminated, and
+ * found by their offset in the pool. Both arrays grow as needed.
+ */
+struct word_entry
 {
- size_t realsize = size * nmemb;
- struct memory *mem = (struct memory *)userp;
+  uint32_t offset;
+  uint32_t len;
+};
 
- char *ptr = realloc(mem->response, mem->size + realsize + 1);
- if(ptr == NULL)
- {
-   fputs("Error allocating memory\n", stderr);
-   exit(EXIT_FAILURE);
- }
+struct word_list
+{
+  wchar_t *pool;
+  size_t pool_len;
+  size_t pool_cap;
+  struct word_entry *entries;
+  int n;
+  int cap;
+};
 
- mem->response = ptr;
- memcpy(&(mem->response[mem->size]), data, realsize);
- mem->size += realsize;
- mem->response[mem->size] = 0;
 
- return realsize;
+static void
+word_list_clear (struct word_list *list)
+{
+  list->pool_len = 0;
+  list->n = 0;
+  return;
 }
-#endif
 
-// n * n grid
+
+static void
+word_list_free (struct word_list *list)
+{
+  free (list->pool);
+  free (list->entries);
+  memset (list, 0, sizeof *list);
+  return;
+}
+
+
+/*!
+ * Appends the first len characters of word to the list
+ * @return the position of the word in the list
+ */
+static int
+word_list_add (struct word_list *list, const wchar_t *word, const size_t len)
+{
+  if (list->n == list->cap)
+  {
+    const int cap = list->cap ? list->cap * 2 : 32;
+    struct word_entry *entries = realloc (list->entries, cap * sizeof *entries);
+    if (entries == NULL)
+    {
+      fputs ("Error allocating memory\n", stderr);
+      exit (EXIT_FAILURE);
+    }
+    list->entries = entries;
+    list->cap = cap;
+  }
+
+  if (list->pool_len + len + 1 > list->pool_cap)
+  {
+    size_t cap = list->pool_cap ? list->pool_cap * 2 : 512;
+    while (cap < list->pool_len + len + 1)
+      cap *= 2;
+    wchar_t *pool = realloc (list->pool, cap * sizeof *pool);
+    if (pool == NULL)
+    {
+      fputs ("Error allocating memory\n", stderr);
+      exit (EXIT_FAILURE);
+    }
+    list->pool = pool;
+    list->pool_cap = cap;
+  }
+
+  wmemcpy (list->pool + list->pool_len, word, len);
+  list->pool[list->pool_len + len] = '\0';
+  list->entries[list->n].offset = list->pool_len;
+  list->entries[list->n].len = len;
+  list->pool_len += len + 1;
+  return list->n++;
+}
+
+
+/*!
+ * Replaces word i of the list with the first len characters of word. The
+ * space of the old word in the pool is only given back by word_list_compact()
+ * @return void
+ */
+static void
+word_list_replace (struct word_list *list, const int i, const wchar_t *word,
+                   const size_t len)
+{
+  word_list_add (list, word, len);
+  list->entries[i] = list->entries[--list->n];
+  return;
+}
+
+
+/*!
+ * Copies the words into a new pool, without the ones that were replaced
+ * @return void
+ */
+static void
+word_list_compact (struct word_list *list)
+{
+  wchar_t *pool = malloc (list->pool_cap * sizeof *pool);
+  if (pool == NULL)
+  {
+    fputs ("Error allocating memory\n", stderr);
+    exit (EXIT_FAILURE);
+  }
+  size_t pool_len = 0;
+  int i;
+  for (i = 0; i < list->n; i++)
+  {
+    const size_t len = list->entries[i].len;
+    wmemcpy (pool + pool_len, list->pool + list->entries[i].offset, len + 1);
+    list->entries[i].offset = pool_len;
+    pool_len += len + 1;
+  }
+  free (list->pool);
+  list->pool = pool;
+  list->pool_len = pool_len;
+  return;
+}
+
+
+static inline const wchar_t *
+word_list_get (const struct word_list *list, const int i)
+{
+  return list->pool + list->entries[i].offset;
+}
+
+
+static inline size_t
+word_list_len (const struct word_list *list, const int i)
+{
+  return list->entries[i].len;
+}
+
+
+/*!
+ * Whether a word can be placed at all: words with spaces or dots are never
+ * used, and words longer than max_len don't fit in the grid
+ */
+static bool
+word_usable (const wchar_t *word, const size_t len, const int max_len)
+{
+  return len > 0 && len <= (size_t) max_len
+    && wcspbrk (word, L" .") == NULL;
+}
+
+
+/*!
+ * Drops the words that can't be placed, so the list is only checked once,
+ * when the words come in, instead of each time a puzzle is made from it
+ * @return the number of words dropped
+ */
+static int
+word_list_filter (struct word_list *list, const int max_len)
+{
+  int i, n = 0;
+  for (i = 0; i < list->n; i++)
+    if (word_usable (word_list_get (list, i), word_list_len (list, i), max_len))
+      list->entries[n++] = list->entries[i];
+  const int dropped = list->n - n;
+  list->n = n;
+  return dropped;
+}
+
+
+// default grid is n * n
 const int GRID_SIZE = 20;       // n
-#define MAX_LEN (GRID_SIZE - 2)
-const int N_DIRECTIONS = 8;
+// Smallest and largest value accepted for --rows and --cols
+const int MIN_GRID_SIZE = 5;
+const int MAX_GRID_SIZE = 32768;
+// a #define so it can size the arrays of directions
+#define N_DIRECTIONS 8
+// How many random starting points are tried for each direction
+const int MAX_TRIES_PER_DIRECTION = 100;
 
 const char *HOST[] = {
   "random-word-api.herokuapp.com",
   NULL
 };
+// The most hosts that can be given with --host
+#define MAX_HOSTS 8
+
+// Where and how the words are fetched
+struct fetch_opts
+{
+  // NULL terminated, like HOST
+  const char **hosts;
+  // --fetch-deadline; with 0, the hosts are tried one after the other and
+  // there's no time limit
+  int deadline_ms;
+};
 
 #ifdef HAVE_CURL
 const char SERVICE[] = "https";
@@ -104,6 +311,93 @@ const char SERVICE[] = "http";
 
 const wchar_t fill_char = '-';
 
+// A cell no word uses yet; it's shown as fill_char
+#define EMPTY_CELL UINT8_MAX
+// The most different letters a grid can hold; the index of each fits in the
+// one byte a cell takes
+#define MAX_SYMBOLS UINT8_MAX
+// Extra bytes after the last cell, so fits_run() can read a little past it
+#define GRID_SLACK 32
+
+/*
+ * The puzzle is one row-major block of memory; the cell at (row, col) is
+ * cells[row * stride + col]. A cell holds the index of its letter in
+ * symbols, or EMPTY_CELL; the letters themselves are only needed when the
+ * grid is printed.
+ */
+struct grid
+{
+  int rows;
+  int cols;
+  size_t stride;
+  uint8_t *cells;
+  // the cells with a random letter in each empty one (see fill_puzzle)
+  uint8_t *filled;
+  // the alphabet of the language (see grid_set_alphabet), followed by any
+  // other letters the words use (see grid_encode)
+  wchar_t symbols[MAX_SYMBOLS];
+  int n_symbols;
+  // the length of the alphabet; filler letters are picked from it
+  int n_letters;
+  // the language the alphabet is from, or NULL (e.g. for --solve)
+  const struct lang_vars *lang;
+  // only used with --placement=bitboard
+  struct bitboard *bits;
+};
+
+/*
+ * The grid as bit masks, one bit per cell: which cells are used (occ), and
+ * for each letter of the alphabet, which cells hold that letter (planes).
+ * Each row takes row_words 64-bit words; bit c of a row is column c.
+ */
+struct bitboard
+{
+  size_t row_words;
+  uint64_t *occ;
+  uint64_t *planes;
+};
+
+#define CELL(grid, row, col) ((grid)->cells[(size_t) (row) * (grid)->stride + (col)])
+
+enum placement
+{
+  // try random starting points, at most MAX_TRIES_PER_DIRECTION per direction
+  PLACE_RANDOM,
+  // check every starting point and direction, then pick one of the places
+  // where the word fits
+  PLACE_EXHAUSTIVE,
+  // same as PLACE_EXHAUSTIVE, but horizontal and vertical words are checked
+  // against a whole row (or column) of starting points at once
+  PLACE_BITBOARD,
+  // place the words together, backtracking when one doesn't fit, and
+  // prefer places that share letters (see place_dense())
+  PLACE_DENSE
+};
+
+// The order in which the words are tried; see order_words()
+enum word_order
+{
+  // the order they were fetched in (shuffled for every puzzle after the
+  // first)
+  ORDER_GIVEN,
+  // longest words first, while the grid still has room for them; words of
+  // the same length keep their given order
+  ORDER_LONGEST
+};
+
+// Settings that apply to every puzzle generated by this process
+struct puzzle_opts
+{
+  int rows;
+  int cols;
+  enum placement placement;
+  // see make_unique()
+  bool unique;
+  enum word_order order;
+  // the search budget of PLACE_DENSE
+  int dense_nodes;
+};
+
 const wchar_t es_alphabet[] = L"ABCDEÉFGHIÍJKLMNÑOÓPQRSTUÜVWXYZ";
 const wchar_t it_alphabet[] = L"ABCDEFGHILMNOPQRSTUVZ";
 const wchar_t de_alphabet[] = L"AÄBCDEFGHIJKLMNOÖPQRSTUÜVWXYZß";
@@ -157,66 +451,358 @@ enum
 };
 
 
-static int
-dec (const int len)
+/*
+ * xoshiro256** (https://prng.di.unimi.it/). Each puzzle generator has its own
+ * state and passes it around, instead of sharing the state behind rand().
+ */
+struct rng
+{
+  uint64_t s[4];
+};
+
+
+static inline uint64_t
+rotl (const uint64_t x, const int k)
 {
-  return (rand () % (GRID_SIZE - len)) + len;
+  return (x << k) | (x >> (64 - k));
 }
 
 
-static int
-noop (const int len)
+static uint64_t
+splitmix64 (uint64_t *x)
+{
+  uint64_t z = (*x += UINT64_C (0x9E3779B97F4A7C15));
+  z = (z ^ (z >> 30)) * UINT64_C (0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C (0x94D049BB133111EB);
+  return z ^ (z >> 31);
+}
+
+
+void
+rng_seed (struct rng *rng, uint64_t seed)
+{
+  int i;
+  for (i = 0; i < 4; i++)
+    rng->s[i] = splitmix64 (&seed);
+  return;
+}
+
+
+/*!
+ * Seeds rng with one of the many sequences that can be made from one seed,
+ * e.g. one for each puzzle, so a puzzle doesn't depend on which thread
+ * generated it or in what order
+ * @return void
+ */
+void
+rng_seed_stream (struct rng *rng, const uint64_t seed, uint64_t stream)
 {
-  // poor person's way to prevent the compiler warning about an unused function parameter
-  if (len < 0)
-    return len;
+  rng_seed (rng, seed ^ splitmix64 (&stream));
+  return;
+}
+
 
-  return rand () % GRID_SIZE;
+static inline uint64_t
+rng_next (struct rng *rng)
+{
+  uint64_t *s = rng->s;
+  const uint64_t result = rotl (s[1] * 5, 7) * 9;
+  const uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl (s[3], 45);
+  return result;
 }
 
 
-static int
-inc (const int len)
+/* Returns a number from 0 to n - 1, without the bias of "rng_next () % n" */
+static inline uint64_t
+rng_below (struct rng *rng, const uint64_t n)
 {
-  return rand () % (GRID_SIZE - len);
+  // values below threshold would make the low results more likely
+  const uint64_t threshold = -n % n;
+  uint64_t r;
+  do
+    r = rng_next (rng);
+  while (r < threshold);
+  return r % n;
 }
 
 
-// Create an array of function pointers
-static int (*op[]) (const int) = {
-  dec,
-  noop,
-  inc
-};
+/* rng_below() for n up to 2^32 without its divisions (Lemire's multiply and
+   shift), for when it's called for each word of a big file */
+static inline uint64_t
+rng_below_small (struct rng *rng, const uint64_t n)
+{
+  if (n > UINT32_MAX)
+    return rng_below (rng, n);
+  uint64_t m = (rng_next (rng) >> 32) * n;
+  if ((uint32_t) m < n)
+  {
+    const uint32_t threshold = -(uint32_t) n % (uint32_t) n;
+    while ((uint32_t) m < threshold)
+      m = (rng_next (rng) >> 32) * n;
+  }
+  return m >> 32;
+}
 
 
-static int
-get_row_op (const int op)
+/*!
+ * Makes a seed that differs between processes started in the same second,
+ * and between calls in the same process
+ */
+uint64_t
+make_seed (void)
 {
-  // Adding 1 so accessing op[-1]() never happens
-  return op + 1;
+  static uint64_t counter;
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  uint64_t x = (uint64_t) ts.tv_sec * UINT64_C (1000000000) + ts.tv_nsec;
+  x ^= (uint64_t) getpid () << 32;
+  x += counter++;
+  return splitmix64 (&x);
 }
 
 
-static int
-get_col_op (const int op)
+/* Picks a random starting row (or column) for a word that moves by delta
+   (-1, 0 or 1) for each letter; size is the number of rows (or columns) in
+   the grid. delta is a constant in the direction kernels, so only one of
+   the branches is left there */
+static inline int
+start_point (const int delta, const int len, const int size, struct rng *rng)
 {
-  return op + 1;
+  if (delta < 0)
+    return rng_below (rng, size - len) + len;
+  if (delta == 0)
+    return rng_below (rng, size);
+  return rng_below (rng, size - len);
 }
 
 
+/*!
+ * Allocates a grid; the cells aren't initialized, and there are no symbols
+ * @return 0 on success, -1 if there wasn't enough memory
+ */
+int
+grid_alloc (struct grid *grid, const int rows, const int cols)
+{
+  grid->rows = rows;
+  grid->cols = cols;
+  grid->stride = cols;
+  grid->n_symbols = grid->n_letters = 0;
+  grid->lang = NULL;
+  grid->bits = NULL;
+  grid->cells = malloc ((size_t) rows * grid->stride + GRID_SLACK);
+  grid->filled = malloc ((size_t) rows * grid->stride);
+  return grid->cells != NULL && grid->filled != NULL ? 0 : -1;
+}
+
+
+/*!
+ * Makes the alphabet the grid's only symbols, so letter l of the alphabet is
+ * stored as l
+ * @return void
+ */
 void
-init_puzzle (wchar_t puzzle[][GRID_SIZE])
+grid_set_alphabet (struct grid *grid, const struct lang_vars *st_lang_ptr)
 {
-  int i, j;
+  wmemcpy (grid->symbols, st_lang_ptr->alphabet, st_lang_ptr->length);
+  grid->n_symbols = grid->n_letters = st_lang_ptr->length;
+  grid->lang = st_lang_ptr;
+  return;
+}
+
+
+/*!
+ * Upper-cases the letters used by the alphabets (ASCII and Latin-1)
+ * without going through the locale; anything else is left to towupper()
+ */
+static wchar_t
+upcase (const wchar_t wc)
+{
+  if ((wc >= 'a' && wc <= 'z') || (wc >= 0xE0 && wc <= 0xFE && wc != 0xF7))
+    return wc - 0x20;
+  if (wc < 0x80 || (wc >= 0xC0 && wc <= 0xFF))
+    return wc;
+  return towupper (wc);
+}
+
+
+/*!
+ * Translates a word to the indexes of its upper-case letters in
+ * grid->symbols, using the tables of grid->lang. Letters that aren't in the
+ * alphabet are added to the symbols.
+ * @param[out] out len indexes
+ * @return 0 on success, -1 if there's no room for another symbol
+ */
+int
+grid_encode (struct grid *grid, const wchar_t *str, const size_t len,
+             uint8_t *out)
+{
+  const struct lang_vars *lang = grid->lang;
+  size_t i;
+  for (i = 0; i < len; i++)
+  {
+    const uint32_t c = str[i];
+    if (lang != NULL && c < LANG_TABLE_SIZE && lang->index[c] != NOT_IN_ALPHABET)
+    {
+      out[i] = lang->index[c];
+      continue;
+    }
+
+    // one of the other symbols, if it's been seen before
+    const wchar_t u =
+      lang != NULL && c < LANG_TABLE_SIZE ? lang->upper[c] : upcase (str[i]);
+    const wchar_t *found = wmemchr (grid->symbols + grid->n_letters, u,
+                                    grid->n_symbols - grid->n_letters);
+    if (found != NULL)
+      out[i] = found - grid->symbols;
+    else if (grid->n_symbols < MAX_SYMBOLS)
+    {
+      grid->symbols[grid->n_symbols] = u;
+      out[i] = grid->n_symbols++;
+    }
+    else
+      return -1;
+  }
+  return 0;
+}
+
+
+void
+grid_free (struct grid *grid)
+{
+  if (grid->bits != NULL)
+  {
+    free (grid->bits->occ);
+    free (grid->bits->planes);
+    free (grid->bits);
+    grid->bits = NULL;
+  }
+  free (grid->cells);
+  free (grid->filled);
+  grid->cells = grid->filled = NULL;
+  return;
+}
+
+
+/*!
+ * Adds the bit masks used by --placement=bitboard to the grid; they're
+ * cleared by init_puzzle and kept up to date by placer
+ * @return 0 on success, -1 if there wasn't enough memory
+ */
+int
+grid_alloc_bitboard (struct grid *grid)
+{
+  struct bitboard *bits = calloc (1, sizeof *bits);
+  if (bits == NULL)
+    return -1;
+  grid->bits = bits;
+  bits->row_words = (grid->cols + 63) / 64;
+  const size_t n = grid->rows * bits->row_words;
+  bits->occ = calloc (n, sizeof *bits->occ);
+  bits->planes = calloc (n * MAX_ALPHABET_LEN, sizeof *bits->planes);
+  if (bits->occ == NULL || bits->planes == NULL)
+    return -1;
+  return 0;
+}
+
+
+static void
+bitboard_set (struct bitboard *bits, const int rows, const int row,
+              const int col, const uint8_t symbol)
+{
+  const uint64_t bit = UINT64_C (1) << (col % 64);
+  const size_t word = row * bits->row_words + col / 64;
+  bits->occ[word] |= bit;
+
+  // There are only planes for the first MAX_ALPHABET_LEN symbols; the others
+  // only mark the cell as used, so another word can't share it
+  if (symbol < MAX_ALPHABET_LEN)
+    bits->planes[symbol * rows * bits->row_words + word] |= bit;
+  return;
+}
+
+
+// The longest word that can be placed in any direction
+int
+get_max_len (const struct grid *grid)
+{
+  return (grid->rows < grid->cols ? grid->rows : grid->cols) - 2;
+}
+
+
+// 20 words for the default 20 x 20 grid
+int
+get_max_words_target (const struct grid *grid)
+{
+  const int n = grid->rows * grid->cols / 20;
+  return n > 0 ? n : 1;
+}
+
 
-  for (i = 0; i < GRID_SIZE; i++)
+// fill_puzzle() makes this many random numbers at a time
+#define FILL_BLOCK 256
+
+/*!
+ * Copies the cells to puzzle->filled, with a random letter of the alphabet
+ * in each empty cell. This is the only place the filler letters are picked,
+ * so every output of the puzzle (stdout, the log, a web page) is the same.
+ * @return void
+ */
+void
+fill_puzzle (struct grid *puzzle, struct rng *rng)
+{
+  const uint32_t n = puzzle->n_letters;
+  uint16_t r[FILL_BLOCK];
+  int i;
+  for (i = 0; i < puzzle->rows; i++)
   {
-    for (j = 0; j < GRID_SIZE; j++)
+    const uint8_t *cell = &CELL (puzzle, i, 0);
+    uint8_t *filled = puzzle->filled + (size_t) i * puzzle->stride;
+    int j, k;
+    for (j = 0; j < puzzle->cols; j += FILL_BLOCK)
     {
-      puzzle[i][j] = fill_char;
+      const int block = puzzle->cols - j < FILL_BLOCK ? puzzle->cols - j : FILL_BLOCK;
+      for (k = 0; k < block; k += 4)
+      {
+        const uint64_t x = rng_next (rng);
+        r[k] = x;
+        r[k + 1] = x >> 16;
+        r[k + 2] = x >> 32;
+        r[k + 3] = x >> 48;
+      }
+      // No calls or branches in here, so the compiler can vectorize it.
+      // (r * n) >> 16 is a number from 0 to n - 1; with 16 random bits,
+      // some letters are picked slightly more often than others (less
+      // than 0.05% for 32 letters), which doesn't matter for filler.
+      for (k = 0; k < block; k++)
+      {
+        const uint8_t letter = (r[k] * n) >> 16;
+        filled[j + k] = cell[j + k] == EMPTY_CELL ? letter : cell[j + k];
+      }
     }
   }
+  return;
+}
+
+
+void
+init_puzzle (struct grid *puzzle)
+{
+  memset (puzzle->cells, EMPTY_CELL,
+          (size_t) puzzle->rows * puzzle->stride + GRID_SLACK);
+
+  struct bitboard *bits = puzzle->bits;
+  if (bits != NULL)
+  {
+    const size_t n = puzzle->rows * bits->row_words;
+    memset (bits->occ, 0, n * sizeof *bits->occ);
+    memset (bits->planes, 0, n * MAX_ALPHABET_LEN * sizeof *bits->planes);
+  }
 }
 
 // Most of the network code and fail function was pinched and adapted from
@@ -242,426 +828,4578 @@ fail (int test, const char *format, ...)
 }
 
 
-static inline int
-get_words (wchar_t str[][BUFSIZ], const int fetch_count, const char *lang, const char *host_ptr)
+/*!
+ * Puts the words in the order they're placed in. For ORDER_LONGEST, the
+ * words are bucketed by length (a counting sort), so it takes one pass over
+ * the words however many there are.
+ * @param[in,out] order indexes into words, in their given order
+ * @param[in] n the number of elements in order
+ * @param[in] max_len no word in the list is longer than this
+ * @return void
+ */
+void
+order_words (int *order, const int n, const struct word_list *words,
+             const int max_len, const enum word_order how)
 {
-  printf ("Attempting to fetch %d words from %s://%s...\n", fetch_count, SERVICE, host_ptr);
-  char *buf_ptr = NULL;
-#ifdef HAVE_CURL
+  if (how == ORDER_GIVEN || n < 2)
+    return;
 
-  CURL *curl;
-  CURLcode res;
-  struct memory chunk = {0};
+  // start[len] becomes the position of the first word of that length
+  int *start = calloc (max_len + 2, sizeof *start);
+  int *given = malloc (n * sizeof *given);
+  fail (start == NULL || given == NULL, "Error allocating memory\n");
+  memcpy (given, order, n * sizeof *given);
+
+  int i, len;
+  for (i = 0; i < n; i++)
+    start[word_list_len (words, given[i])]++;
+  int pos = 0;
+  for (len = max_len; len >= 0; len--)
+  {
+    const int in_bucket = start[len];
+    start[len] = pos;
+    pos += in_bucket;
+  }
+  for (i = 0; i < n; i++)
+    order[start[word_list_len (words, given[i])]++] = given[i];
 
-  curl_global_init(CURL_GLOBAL_DEFAULT);
-  curl = curl_easy_init();
+  free (start);
+  free (given);
+  return;
+}
 
-  if(curl) {
-    const char *url_format = "https://%s/word?number=%d&lang=%s";
-    char url[BUFSIZ];
-    if ((size_t)snprintf(url, sizeof url, url_format, host_ptr, fetch_count, lang) >= sizeof url)
+
+/*!
+ * Decodes one UTF-8 sequence. This doesn't depend on the locale, so word
+ * lists are read the same way no matter what LC_CTYPE is.
+ * @param[out] wc the decoded character
+ * @return the number of bytes used, or 0 if the sequence is invalid
+ */
+static size_t
+utf8_decode (wchar_t *wc, const unsigned char *s, const size_t len)
+{
+  if (len == 0)
+    return 0;
+  if (s[0] < 0x80)
+  {
+    *wc = s[0];
+    return 1;
+  }
+
+  size_t n;
+  uint32_t cp;
+  if ((s[0] & 0xE0) == 0xC0)
+  {
+    n = 2;
+    cp = s[0] & 0x1F;
+  }
+  else if ((s[0] & 0xF0) == 0xE0)
+  {
+    n = 3;
+    cp = s[0] & 0x0F;
+  }
+  else if ((s[0] & 0xF8) == 0xF0)
+  {
+    n = 4;
+    cp = s[0] & 0x07;
+  }
+  else
+    return 0;
+
+  if (n > len)
+    return 0;
+  size_t i;
+  for (i = 1; i < n; i++)
+  {
+    if ((s[i] & 0xC0) != 0x80)
+      return 0;
+    cp = (cp << 6) | (s[i] & 0x3F);
+  }
+  *wc = cp;
+  return n;
+}
+
+
+enum json_state
+{
+  JSON_START,      // before the '['
+  JSON_FIRST,      // after the '[', where a string or the ']' can come
+  JSON_VALUE,      // after a ',', where a string has to come
+  JSON_STRING,
+  JSON_ESCAPE,     // after a '\' in a string
+  JSON_UNICODE,    // in the hex digits of a "\uXXXX"
+  JSON_NEXT,       // after a string, where a ',' or the ']' can come
+  JSON_DONE,
+  JSON_ERROR
+};
+
+/*
+ * Reads a JSON array of strings, such as the word hosts send, as it's
+ * received: each piece of the response goes through json_words_feed() and
+ * the words go straight into the list, so a response of any size only takes
+ * the room of its longest word while it's read
+ */
+struct json_words
+{
+  struct word_list *list;
+  int max_words;
+  // longer words don't fit in the grid
+  size_t max_len;
+  enum json_state state;
+  // the error that made state JSON_ERROR
+  const char *error;
+  // the word being read, which grows up to max_len characters
+  wchar_t *word;
+  size_t word_cap;
+  size_t len;
+  // the word is longer than max_len, so it's skipped
+  bool too_long;
+  // a UTF-8 sequence or "\uXXXX" that was cut off by the end of a piece
+  unsigned char utf8[4];
+  size_t utf8_len;
+  uint32_t hex;
+  int n_hex;
+  // the first half of a UTF-16 surrogate pair
+  uint32_t high;
+};
+
+
+/*!
+ * @param[out] list the words, at most max_words of them; the ones after that
+ * are only checked
+ * @param[in] max_len the longest word that's kept
+ */
+static void
+json_words_init (struct json_words *p, struct word_list *list,
+                 const int max_words, const int max_len)
+{
+  memset (p, 0, sizeof *p);
+  p->list = list;
+  p->max_words = max_words;
+  p->max_len = max_len;
+  word_list_clear (list);
+  return;
+}
+
+
+static void
+json_words_free (struct json_words *p)
+{
+  free (p->word);
+  p->word = NULL;
+  p->word_cap = 0;
+  return;
+}
+
+
+static inline void
+json_words_fail (struct json_words *p, const char *error)
+{
+  p->state = JSON_ERROR;
+  p->error = error;
+  return;
+}
+
+
+static inline void
+json_words_put (struct json_words *p, const wchar_t wc)
+{
+  if (p->len == p->max_len)
+  {
+    p->too_long = true;
+    return;
+  }
+  if (p->len == p->word_cap)
+  {
+    p->word_cap = p->word_cap ? p->word_cap * 2 : 64;
+    if (p->word_cap > p->max_len)
+      p->word_cap = p->max_len;
+    wchar_t *word = realloc (p->word, p->word_cap * sizeof *word);
+    fail (word == NULL, "Error allocating memory\n");
+    p->word = word;
+  }
+  p->word[p->len++] = wc;
+  return;
+}
+
+
+/* Adds a character from a "\uXXXX", joining the two halves of a surrogate
+   pair */
+static void
+json_words_put_utf16 (struct json_words *p, const uint32_t u)
+{
+  if (p->high != 0)
+  {
+    const uint32_t high = p->high;
+    p->high = 0;
+    if (u >= 0xDC00 && u <= 0xDFFF)
     {
-      fputs("url truncated\n", stderr);
-      exit(EXIT_FAILURE);
+      json_words_put (p, 0x10000 + ((high - 0xD800) << 10) + (u - 0xDC00));
+      return;
     }
+    json_words_fail (p, "unpaired surrogate");
+  }
+  else if (u >= 0xD800 && u <= 0xDBFF)
+    p->high = u;
+  else if (u >= 0xDC00 && u <= 0xDFFF)
+    json_words_fail (p, "unpaired surrogate");
+  else
+    json_words_put (p, u);
+  return;
+}
 
-    curl_easy_setopt(curl, CURLOPT_URL, url);
 
-    // By default, the data will be sent to stdout when curl_easy_perform() is called. So we set these 3 options instead.
-    // After curl_easy_perform is called, the data will be in chunk.response.
+/* The length of the UTF-8 sequence that starts with c, or 0 if c can't start
+   one */
+static inline size_t
+utf8_seq_len (const unsigned char c)
+{
+  if ((c & 0xE0) == 0xC0)
+    return 2;
+  if ((c & 0xF0) == 0xE0)
+    return 3;
+  if ((c & 0xF8) == 0xF0)
+    return 4;
+  return 0;
+}
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
 
+/*!
+ * Parses the next len bytes of the response. Once the parser fails, the rest
+ * of the response is ignored.
+ * @return void
+ */
+static void
+json_words_feed (struct json_words *p, const char *data, const size_t len)
+{
+  const unsigned char *s = (const unsigned char *) data;
+  size_t i;
+  for (i = 0; i < len && p->state != JSON_ERROR; i++)
+  {
+    const unsigned char c = s[i];
+    switch (p->state)
+    {
+    case JSON_START:
+      if (c == '[')
+        p->state = JSON_FIRST;
+      break;
 
-#ifdef SKIP_PEER_VERIFICATION
-    /*
-     * If you want to connect to a site who is not using a certificate that is
-     * signed by one of the certs in the CA bundle you have, you can skip the
-     * verification of the server's certificate. This makes the connection
-     * A LOT LESS SECURE.
-     *
-     * If you have a CA cert for the server stored someplace else than in the
-     * default bundle, then the CURLOPT_CAPATH option might come handy for
-     * you.
-     */
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-#endif
+    case JSON_FIRST:
+    case JSON_VALUE:
+    case JSON_NEXT:
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        break;
+      if (c == ']' && p->state != JSON_VALUE)
+        p->state = JSON_DONE;
+      else if (c == '"' && p->state != JSON_NEXT)
+      {
+        p->state = JSON_STRING;
+        p->len = 0;
+        p->too_long = false;
+      }
+      else if (c == ',' && p->state == JSON_NEXT)
+        p->state = JSON_VALUE;
+      else
+        json_words_fail (p, "expected a string");
+      break;
 
-#ifdef SKIP_HOSTNAME_VERIFICATION
-    /*
-     * If the site you are connecting to uses a different host name that what
-     * they have mentioned in their server certificate's commonName (or
-     * subjectAltName) fields, libcurl will refuse to connect. You can skip
-     * this check, but this will make the connection less secure.
-     */
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-#endif
+    case JSON_STRING:
+      if (p->utf8_len > 0)
+      {
+        p->utf8[p->utf8_len++] = c;
+        if (p->utf8_len < utf8_seq_len (p->utf8[0]))
+          break;
+        wchar_t wc;
+        if (utf8_decode (&wc, p->utf8, p->utf8_len) == 0)
+          json_words_fail (p, "invalid UTF-8");
+        else
+          json_words_put (p, wc);
+        p->utf8_len = 0;
+      }
+      else if (p->high != 0 && c != '\\')
+        json_words_fail (p, "unpaired surrogate");
+      else if (c == '"')
+      {
+        if (p->len > 0 && !p->too_long && p->list->n < p->max_words)
+          word_list_add (p->list, p->word, p->len);
+        p->state = JSON_NEXT;
+      }
+      else if (c == '\\')
+        p->state = JSON_ESCAPE;
+      else if (c < 0x20)
+        json_words_fail (p, "control character in a string");
+      else if (c < 0x80)
+        json_words_put (p, c);
+      else if (utf8_seq_len (c) == 0)
+        json_words_fail (p, "invalid UTF-8");
+      else
+        p->utf8[p->utf8_len++] = c;
+      break;
+
+    case JSON_ESCAPE:
+      p->state = JSON_STRING;
+      if (c == 'u')
+      {
+        p->state = JSON_UNICODE;
+        p->hex = 0;
+        p->n_hex = 0;
+        break;
+      }
+      if (p->high != 0)
+        json_words_fail (p, "unpaired surrogate");
+      else if (c == '"' || c == '\\' || c == '/')
+        json_words_put (p, c);
+      else
+      {
+        const char *escapes = "b\bf\fn\nr\rt\t";
+        const char *e = c != '\0' ? strchr (escapes, c) : NULL;
+        if (e == NULL || (e - escapes) % 2 != 0)
+          json_words_fail (p, "invalid escape");
+        else
+          json_words_put (p, e[1]);
+      }
+      break;
 
-    /* Perform the request, res will get the return code */
-    res = curl_easy_perform(curl);
-    /* Check for errors */
-    fail (res != CURLE_OK, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+    case JSON_UNICODE:
+      if (!isxdigit (c))
+      {
+        json_words_fail (p, "invalid escape");
+        break;
+      }
+      p->hex = p->hex << 4 | (isdigit (c) ? c - '0' : (c | 0x20) - 'a' + 10);
+      if (++p->n_hex == 4)
+      {
+        p->state = JSON_STRING;
+        json_words_put_utf16 (p, p->hex);
+      }
+      break;
 
-    buf_ptr = chunk.response;
+    case JSON_DONE:
+      if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+        json_words_fail (p, "data after the array");
+      break;
 
-    /* always cleanup */
-    curl_easy_cleanup(curl);
+    case JSON_ERROR:
+      break;
+    }
   }
-  else
-    fputs ("Unable to initialize curl\n", stderr);
+  return;
+}
+
+
+#ifdef HAVE_CURL
+static size_t cb(void *data, size_t size, size_t nmemb, void *userp)
+{
+ size_t realsize = size * nmemb;
+ json_words_feed((struct json_words *)userp, data, realsize);
+ return realsize;
+}
+#endif
+
+
+/*!
+ * Fills in the tables of a language: the upper case of each character below
+ * LANG_TABLE_SIZE, and where that letter is in the alphabet
+ * @return void
+ */
+void
+lang_init (struct lang_vars *st_lang_ptr)
+{
+  int c;
+  for (c = 0; c < LANG_TABLE_SIZE; c++)
+  {
+    const wchar_t u = upcase (c);
+    const wchar_t *found =
+      c != '\0' ? wmemchr (st_lang_ptr->alphabet, u, st_lang_ptr->length) : NULL;
+    st_lang_ptr->upper[c] = u;
+    st_lang_ptr->index[c] = found != NULL ? found - st_lang_ptr->alphabet : NOT_IN_ALPHABET;
+  }
+  return;
+}
 
-  curl_global_cleanup();
 
-  if (buf_ptr == NULL)
-    exit(EXIT_FAILURE);
+static inline void
+fetcher_close (struct fetcher *f)
+{
+#ifdef HAVE_CURL
+  if (f->curl != NULL)
+    curl_easy_cleanup (f->curl);
+  f->curl = NULL;
+#else
+  if (f->fd >= 0 && close (f->fd) != 0)
+    fputs ("Error closing socket\n", stderr);
+  f->fd = -1;
+  f->in_start = f->in_len = 0;
+#endif
+  f->host = NULL;
+  return;
+}
+
 
+static inline void
+fetcher_init (struct fetcher *f, const int timeout_ms)
+{
+#ifdef HAVE_CURL
+  f->curl = NULL;
 #else
+  f->fd = -1;
+#endif
+  fetcher_close (f);
+  f->timeout_ms = timeout_ms;
+  return;
+}
+
+
+#ifndef HAVE_CURL
+// macOS has no MSG_NOSIGNAL; there, http_connect() sets SO_NOSIGPIPE on the
+// socket instead, so a server that closes the connection doesn't kill us
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Skips the "http://" (or "https://") a host given with --host can start
+   with */
+static const char *
+host_name (const char *host)
+{
+  const char *p = strstr (host, "://");
+  return p != NULL ? p + 3 : host;
+}
+
 
+static int
+http_connect (struct fetcher *f, const char *host)
+{
   struct addrinfo hints, *rp, *result;
-  int error;
   /* "s" is the file descriptor of the socket. */
-  int s;
+  int s = -1;
 
   memset (&hints, 0, sizeof (hints));
   /* Don't specify what type of internet connection. */
   hints.ai_family = PF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
-  error = getaddrinfo (host_ptr, SERVICE, &hints, &result);
-  fail (error, gai_strerror (error));
-  s = -1;
-  for (rp = result; rp !=NULL; rp = rp->ai_next)
+  if (strncmp (host, "https://", 8) == 0)
+  {
+    fprintf (stderr, "%s: https needs a build with curl\n", host);
+    return -1;
+  }
+  // a host can have a port ("localhost:8080")
+  char name[NI_MAXHOST];
+  const char *service = SERVICE;
+  snprintf (name, sizeof name, "%s", host_name (host));
+  char *colon = strrchr (name, ':');
+  if (colon != NULL)
+  {
+    *colon = '\0';
+    service = colon + 1;
+  }
+
+  const int error = getaddrinfo (name, service, &hints, &result);
+  if (error != 0)
+  {
+    fprintf (stderr, "%s\n", gai_strerror (error));
+    return -1;
+  }
+  // on Linux, the send timeout is also the connect timeout
+  const struct timeval timeout = {
+    f->timeout_ms / 1000, f->timeout_ms % 1000 * 1000
+  };
+  for (rp = result; rp != NULL && s < 0; rp = rp->ai_next)
   {
     s = socket (rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-    fail (s < 0, "socket: %s\n", strerror (errno));
+    if (s < 0)
+    {
+      fprintf (stderr, "socket: %s\n", strerror (errno));
+      continue;
+    }
+    if (f->timeout_ms > 0)
+    {
+      setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+      setsockopt (s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+    }
+#ifdef SO_NOSIGPIPE
+    const int on = 1;
+    setsockopt (s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof on);
+#endif
     if (connect (s, rp->ai_addr, rp->ai_addrlen) < 0)
     {
       fprintf (stderr, "connect: %s\n", strerror (errno));
       close (s);
-      exit (EXIT_FAILURE);
+      s = -1;
     }
-    break;
   }
   freeaddrinfo (result);
+  if (s < 0)
+    return -1;
+
+  f->fd = s;
+  f->host = host;
+  f->in_start = f->in_len = 0;
+  return 0;
+}
+
+
+/* Makes sure f->in has at least one unused byte
+   @return 1 if it has, 0 if the server closed the connection, -1 on error */
+static int
+http_fill (struct fetcher *f)
+{
+  if (f->in_len > 0)
+    return 1;
+  ssize_t n;
+  do
+    n = recv (f->fd, f->in, sizeof f->in, 0);
+  while (n < 0 && errno == EINTR);
+  if (n < 0)
+  {
+    // the timeout set by http_connect()
+    fprintf (stderr, "recv: %s\n", errno == EAGAIN || errno == EWOULDBLOCK ?
+             "timed out" : strerror (errno));
+    return -1;
+  }
+  f->in_start = 0;
+  f->in_len = n;
+  return n > 0;
+}
+
+
+/* Reads a line of the response's header (or a chunk size), without the
+   line ending
+   @return 0 on success, -1 on error or if the line doesn't fit */
+static int
+http_read_line (struct fetcher *f, char *line, const size_t size)
+{
+  size_t n = 0;
+  while (1)
+  {
+    if (http_fill (f) != 1)
+      return -1;
+    const char c = f->in[f->in_start++];
+    f->in_len--;
+    if (c == '\n')
+      break;
+    if (n + 1 >= size)
+      return -1;
+    line[n++] = c;
+  }
+  if (n > 0 && line[n - 1] == '\r')
+    n--;
+  line[n] = '\0';
+  return 0;
+}
+
+
+// The longest response body that's read; a list of words is much shorter
+#define HTTP_MAX_BODY (16 << 20)
+
+/* Passes n bytes of the body to the parser, or everything up to the end of
+   the connection if n is SIZE_MAX (which can't be more than HTTP_MAX_BODY)
+   @return 0 on success, -1 on error */
+static int
+http_read_body (struct fetcher *f, size_t n, struct json_words *body)
+{
+  size_t total = 0;
+  while (n > 0)
+  {
+    const int r = http_fill (f);
+    if (r <= 0)
+      return r == 0 && n == SIZE_MAX ? 0 : -1;
+    const size_t take = f->in_len < n ? f->in_len : n;
+    json_words_feed (body, f->in + f->in_start, take);
+    f->in_start += take;
+    f->in_len -= take;
+    if (n != SIZE_MAX)
+      n -= take;
+    else if ((total += take) > HTTP_MAX_BODY)
+      return -1;
+  }
+  return 0;
+}
+
+
+/* Reads the size at the start of s (a Content-Length value, or the size of
+   a chunk, with anything after it ignored)
+   @return the size, or SIZE_MAX if there's none or it's over HTTP_MAX_BODY */
+static size_t
+http_parse_size (const char *s, const int base)
+{
+  while (*s == ' ' || *s == '\t')
+    s++;
+  // strtoull() would take a sign
+  if (!isxdigit ((unsigned char) *s))
+    return SIZE_MAX;
+  char *end;
+  errno = 0;
+  const unsigned long long n = strtoull (s, &end, base);
+  return end == s || errno != 0 || n > HTTP_MAX_BODY ? SIZE_MAX : n;
+}
+
+
+/*!
+ * Sends a GET request on the open connection and reads the response. The
+ * body ends where Content-Length or the chunked encoding says, so the
+ * connection can be used again, unless the server closes it.
+ * @return the response's status code, or -1 if the request failed
+ */
+static int
+http_get (struct fetcher *f, const char *path, struct json_words *body)
+{
+  /* "format" is the format of the HTTP request we send to the web
+     server. */
+
+  const char *format = "\
+GET %s HTTP/1.1\r\n\
+Host: %s\r\n\
+User-Agent: github.com/theimpossibleastronaut/aawordsearch (v%s)\r\n\
+\r\n";
+
+  char msg[BUFSIZ];
+  const int len = snprintf (msg, BUFSIZ, format, path, host_name (f->host),
+                            VERSION);
+  if (len >= BUFSIZ)
+  {
+    fputs ("snprintf failed.", stderr);
+    return -1;
+  }
+
+  int sent = 0;
+  while (sent < len)
+  {
+    const ssize_t n = send (f->fd, msg + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno != EINTR)
+    {
+      fprintf (stderr, "send failed: %s\n", strerror (errno));
+      return -1;
+    }
+    if (n > 0)
+      sent += n;
+  }
+
+  char line[BUFSIZ];
+  int status;
+  if (http_read_line (f, line, sizeof line) != 0
+      || sscanf (line, "HTTP/%*d.%*d %d", &status) != 1)
+  {
+    fputs ("Invalid response from the server\n", stderr);
+    return -1;
+  }
+  bool keep_alive = strncmp (line, "HTTP/1.0", 8) != 0;
+
+  // header names and the values used here aren't case sensitive
+  size_t content_length = SIZE_MAX;
+  bool chunked = false, bad_length = false;
+  while (1)
+  {
+    if (http_read_line (f, line, sizeof line) != 0)
+    {
+      fputs ("Invalid response from the server\n", stderr);
+      return -1;
+    }
+    if (*line == '\0')
+      break;
+    char *p;
+    for (p = line; *p != '\0'; p++)
+      *p = tolower ((unsigned char) *p);
+    if (strncmp (line, "content-length:", 15) == 0)
+    {
+      content_length = http_parse_size (line + 15, 10);
+      bad_length = content_length == SIZE_MAX;
+    }
+    else if (strncmp (line, "transfer-encoding:", 18) == 0)
+      chunked = strstr (line + 18, "chunked") != NULL;
+    else if (strncmp (line, "connection:", 11) == 0)
+      keep_alive = strstr (line + 11, "close") == NULL;
+  }
+
+  int r = 0;
+  if (chunked)
+  {
+    size_t total = 0;
+    while (1)
+    {
+      // a chunk's size can be followed by ";name=value" extensions
+      if (http_read_line (f, line, sizeof line) != 0)
+        return -1;
+      const size_t n = http_parse_size (line, 16);
+      if (n == SIZE_MAX || (total += n) > HTTP_MAX_BODY)
+        return -1;
+      if (n == 0)
+        break;
+      // each chunk is followed by a line ending
+      if (http_read_body (f, n, body) != 0
+          || http_read_line (f, line, sizeof line) != 0)
+        return -1;
+    }
+    // skip the trailer, which ends with an empty line
+    do
+      r = http_read_line (f, line, sizeof line);
+    while (r == 0 && *line != '\0');
+  }
+  else if (bad_length)
+  {
+    fputs ("Invalid Content-Length from the server\n", stderr);
+    return -1;
+  }
+  else
+  {
+    // without a length, the body ends when the server closes the connection
+    if (content_length == SIZE_MAX)
+      keep_alive = false;
+    r = http_read_body (f, content_length, body);
+  }
+  if (r != 0)
+    return -1;
+
+  if (!keep_alive)
+    fetcher_close (f);
+  return status;
+}
+#endif
+
+
+/*!
+ * Gets path from host, over the connection of the last fetch if it was from
+ * the same host and is still open
+ * @param[in,out] body parses the body of the response as it's received
+ * @return 0 on success, -1 on error
+ */
+static inline int
+fetch_body (struct fetcher *f, const char *host, const char *path,
+            struct json_words *body)
+{
+#ifdef HAVE_CURL
+  if (f->curl == NULL)
+  {
+    f->curl = curl_easy_init ();
+    if (f->curl == NULL)
+    {
+      fputs ("Unable to initialize curl\n", stderr);
+      return -1;
+    }
+
+    // By default, the data will be sent to stdout when curl_easy_perform() is called. So we set these options instead.
+    // After curl_easy_perform is called, the data will be in body.
+    curl_easy_setopt(f->curl, CURLOPT_WRITEFUNCTION, cb);
+    curl_easy_setopt(f->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    // fetches can run on several threads at once, so no signals for the
+    // timeouts
+    curl_easy_setopt(f->curl, CURLOPT_NOSIGNAL, 1L);
+    if (f->timeout_ms > 0)
+      curl_easy_setopt(f->curl, CURLOPT_TIMEOUT_MS, (long) f->timeout_ms);
+
+#ifdef SKIP_PEER_VERIFICATION
+    /*
+     * If you want to connect to a site who is not using a certificate that is
+     * signed by one of the certs in the CA bundle you have, you can skip the
+     * verification of the server's certificate. This makes the connection
+     * A LOT LESS SECURE.
+     *
+     * If you have a CA cert for the server stored someplace else than in the
+     * default bundle, then the CURLOPT_CAPATH option might come handy for
+     * you.
+     */
+    curl_easy_setopt(f->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+#endif
+
+#ifdef SKIP_HOSTNAME_VERIFICATION
+    /*
+     * If the site you are connecting to uses a different host name that what
+     * they have mentioned in their server certificate's commonName (or
+     * subjectAltName) fields, libcurl will refuse to connect. You can skip
+     * this check, but this will make the connection less secure.
+     */
+    curl_easy_setopt(f->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+#endif
+  }
+
+  // curl keeps the connection open in the handle and reuses it when the
+  // next URL is on the same host
+  char url[BUFSIZ];
+  const bool has_scheme = strstr (host, "://") != NULL;
+  if ((size_t)snprintf(url, sizeof url, "%s%s%s%s", has_scheme ? "" : SERVICE,
+                       has_scheme ? "" : "://", host, path) >= sizeof url)
+  {
+    fputs("url truncated\n", stderr);
+    return -1;
+  }
+  f->host = host;
+  curl_easy_setopt(f->curl, CURLOPT_URL, url);
+  curl_easy_setopt(f->curl, CURLOPT_WRITEDATA, (void *)body);
+
+  const CURLcode res = curl_easy_perform(f->curl);
+  if (res != CURLE_OK)
+  {
+    fprintf (stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+    return -1;
+  }
+  long status = 0;
+  curl_easy_getinfo(f->curl, CURLINFO_RESPONSE_CODE, &status);
+
+#else
+
+  // The server can close a kept-alive connection at any time, so if the
+  // request fails on one, it's sent again on a new connection
+  const bool reused = f->fd >= 0 && strcmp (f->host, host) == 0;
+  if (!reused)
+  {
+    fetcher_close (f);
+    if (http_connect (f, host) != 0)
+      return -1;
+  }
+  int status = http_get (f, path, body);
+  if (status < 0 && reused)
+  {
+    json_words_free (body);
+    json_words_init (body, body->list, body->max_words, body->max_len);
+    fetcher_close (f);
+    status = http_connect (f, host) == 0 ? http_get (f, path, body) : -1;
+  }
+  if (status < 0)
+  {
+    fetcher_close (f);
+    return -1;
+  }
+#endif
+
+  // an error page doesn't close the connection
+  if (status != 200)
+  {
+    fprintf (stderr, "The server answered with status %d\n", (int) status);
+    return -1;
+  }
+  return 0;
+}
+
+
+/*!
+ * Fetches fetch_count words for lang from host_ptr
+ * @param[out] list the words, without the ones longer than max_len
+ * @return the number of words, or -1 on error
+ */
+static inline int
+get_words (struct fetcher *f, struct word_list *list, const int fetch_count,
+           const char *lang, const int max_len, const char *host_ptr)
+{
+  const bool has_scheme = strstr (host_ptr, "://") != NULL;
+  printf ("Attempting to fetch %d words from %s%s%s...\n", fetch_count,
+          has_scheme ? "" : SERVICE, has_scheme ? "" : "://", host_ptr);
+  char path[BUFSIZ];
+  if ((size_t) snprintf (path, sizeof path, "/word?number=%d&lang=%s",
+                         fetch_count, lang) >= sizeof path)
+  {
+    fputs ("url truncated\n", stderr);
+    return -1;
+  }
+
+  struct json_words parser;
+  json_words_init (&parser, list, fetch_count, max_len);
+  const int r = fetch_body (f, host_ptr, path, &parser);
+  json_words_free (&parser);
+  if (r != 0)
+  {
+    word_list_clear (list);
+    return -1;
+  }
+
+  if (parser.state != JSON_DONE)
+  {
+    fprintf (stderr, "The server's response isn't a list of words: %s\n",
+             parser.state == JSON_ERROR ? parser.error : "it ends too soon");
+    word_list_clear (list);
+    return -1;
+  }
+  if (list->n == 0)
+  {
+    fputs ("The server sent no words\n", stderr);
+    return -1;
+  }
+
+  return list->n;
+}
+
+
+/* Checks whether a word fits len cells that are step apart: each of them has
+   to be empty or already hold the same letter */
+static inline bool
+word_fits (const uint8_t *cell, const ptrdiff_t step, const uint8_t *word,
+           const size_t len)
+{
+  size_t i;
+  for (i = 0; i < len; i++, cell += step)
+    if (!(*cell == word[i] || *cell == EMPTY_CELL))
+      return false;
+  return true;
+}
+
+
+// number of neighbouring starting cells fits_run() checks at once
+#define FITS_RUN 32
+
+/* Checks the starting cells cell[0] to cell[FITS_RUN - 1] at once; bit j of
+   the result is set if the word fits at cell + j. Whatever the direction, the
+   k-th letters of these words are next to each other in the grid, so the
+   vector versions below compare all of them with one or two loads. This is
+   the fallback for CPUs without them */
+static uint32_t
+fits_run_scalar (const uint8_t *cell, const ptrdiff_t step,
+                 const uint8_t *word, const size_t len)
+{
+  uint32_t fits = 0;
+  int j;
+  for (j = 0; j < FITS_RUN; j++)
+    fits |= (uint32_t) word_fits (cell + j, step, word, len) << j;
+  return fits;
+}
+
+
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#define HAVE_SIMD_FITS
+#include <immintrin.h>
+
+__attribute__ ((target ("sse2"))) static uint32_t
+fits_run_sse2 (const uint8_t *cell, const ptrdiff_t step,
+               const uint8_t *word, const size_t len)
+{
+  const __m128i empty = _mm_set1_epi8 ((char) EMPTY_CELL);
+  __m128i ok_lo = _mm_set1_epi8 (-1), ok_hi = ok_lo;
+  size_t k;
+  for (k = 0; k < len; k++, cell += step)
+  {
+    const __m128i w = _mm_set1_epi8 (word[k]);
+    const __m128i lo = _mm_loadu_si128 ((const __m128i *) cell);
+    const __m128i hi = _mm_loadu_si128 ((const __m128i *) (cell + 16));
+    ok_lo = _mm_and_si128 (ok_lo, _mm_or_si128 (_mm_cmpeq_epi8 (lo, w),
+                                                _mm_cmpeq_epi8 (lo, empty)));
+    ok_hi = _mm_and_si128 (ok_hi, _mm_or_si128 (_mm_cmpeq_epi8 (hi, w),
+                                                _mm_cmpeq_epi8 (hi, empty)));
+    if (_mm_movemask_epi8 (_mm_or_si128 (ok_lo, ok_hi)) == 0)
+      return 0;
+  }
+  return (uint32_t) _mm_movemask_epi8 (ok_lo)
+    | (uint32_t) _mm_movemask_epi8 (ok_hi) << 16;
+}
+
+
+__attribute__ ((target ("avx2"))) static uint32_t
+fits_run_avx2 (const uint8_t *cell, const ptrdiff_t step,
+               const uint8_t *word, const size_t len)
+{
+  const __m256i empty = _mm256_set1_epi8 ((char) EMPTY_CELL);
+  __m256i ok = _mm256_set1_epi8 (-1);
+  size_t k;
+  for (k = 0; k < len; k++, cell += step)
+  {
+    const __m256i c = _mm256_loadu_si256 ((const __m256i *) cell);
+    ok = _mm256_and_si256 (ok, _mm256_or_si256 (
+      _mm256_cmpeq_epi8 (c, _mm256_set1_epi8 (word[k])),
+      _mm256_cmpeq_epi8 (c, empty)));
+    if (_mm256_testz_si256 (ok, ok))
+      return 0;
+  }
+  return _mm256_movemask_epi8 (ok);
+}
+#endif
+
+
+static uint32_t (*fits_run) (const uint8_t *, ptrdiff_t, const uint8_t *,
+                             size_t) = fits_run_scalar;
+
+/*!
+ * Picks the fastest version of fits_run() the CPU supports. Called once from
+ * main(), before any threads are started
+ */
+void
+fits_run_init (void)
+{
+#ifdef HAVE_SIMD_FITS
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    fits_run = fits_run_avx2;
+  else if (__builtin_cpu_supports ("sse2"))
+    fits_run = fits_run_sse2;
+#endif
+  return;
+}
+
+
+/*!
+ * Writes a word into the grid if it fits at row, col, going dr rows and dc
+ * columns for each letter
+ * @param[in] word the word's symbols (see grid_encode)
+ * @return 0 if the word was placed, -1 if a cell holds another letter
+ */
+static inline __attribute__ ((always_inline)) int
+place_at (struct grid *puzzle, const int row, const int col, const int dr,
+          const int dc, const uint8_t *word, const size_t len)
+{
+  // distance between two letters of the word in the grid
+  const ptrdiff_t step = dr * (ptrdiff_t) puzzle->stride + dc;
+  uint8_t *cell = &CELL (puzzle, row, col);
+  if (!word_fits (cell, step, word, len))
+    return -1;
+
+  size_t i;
+  if (step == 1)
+    memcpy (cell, word, len);
+  else
+    for (i = 0; i < len; i++)
+      cell[i * step] = word[i];
+
+  if (puzzle->bits != NULL)
+    for (i = 0; i < len; i++)
+      bitboard_set (puzzle->bits, puzzle->rows, row + (int) i * dr,
+                    col + (int) i * dc, word[i]);
+  return 0;
+}
+
+
+/*!
+ * Writes a word into the grid if it fits there
+ * @param[in] word the word's symbols (see grid_encode)
+ * @return 0 if the word was placed, -1 if a cell holds another letter
+ */
+static inline int
+placer (dir_op * dir_op, const uint8_t *word, const size_t len,
+        struct grid *puzzle)
+{
+  return place_at (puzzle, dir_op->begin_row, dir_op->begin_col,
+                   dir_op->row, dir_op->col, word, len);
+}
+
+
+/* One kernel per direction for PLACE_RANDOM: it tries up to
+   MAX_TRIES_PER_DIRECTION random starting points. dr and dc are constants,
+   so the starting points, the step between letters and the loops in
+   place_at() are worked out by the compiler for each direction, and the
+   direction is only looked up once per word and direction. */
+#define DIRECTION_KERNEL(name, dr, dc)                                        \
+  static int                                                                  \
+  place_random_##name (const uint8_t *word, const size_t len,                 \
+                       struct grid *puzzle, struct rng *rng)                  \
+  {                                                                           \
+    int ctr;                                                                  \
+    for (ctr = 0; ctr < MAX_TRIES_PER_DIRECTION; ctr++)                       \
+    {                                                                         \
+      const int row = start_point (dr, len, puzzle->rows, rng);               \
+      const int col = start_point (dc, len, puzzle->cols, rng);               \
+      if (place_at (puzzle, row, col, dr, dc, word, len) == 0)                \
+        return 0;                                                             \
+    }                                                                         \
+    return -1;                                                                \
+  }
+
+DIRECTION_KERNEL (horizontal, HORIZONTAL_NOOP, HORIZONTAL_INC)
+DIRECTION_KERNEL (horizontal_backward, HORIZONTAL_BACKWARD_NOOP, HORIZONTAL_BACKWARD_DEC)
+DIRECTION_KERNEL (vertical, VERTICAL_INC, VERTICAL_NOOP)
+DIRECTION_KERNEL (vertical_up, VERTICAL_UP_DEC, VERTICAL_UP_NOOP)
+DIRECTION_KERNEL (diagonal_down_right, DIAGONAL_DOWN_RIGHT_INC, DIAGONAL_DOWN_RIGHT_INC)
+DIRECTION_KERNEL (diagonal_down_left, DIAGONAL_DOWN_LEFT_INC, DIAGONAL_DOWN_LEFT_DEC)
+DIRECTION_KERNEL (diagonal_up_right, DIAGONAL_UP_RIGHT_DEC, DIAGONAL_UP_RIGHT_INC)
+DIRECTION_KERNEL (diagonal_up_left, DIAGONAL_UP_LEFT_DEC, DIAGONAL_UP_LEFT_DEC)
+
+// In the same order as the directions in create_dir_op()
+static int (*const place_random[N_DIRECTIONS]) (const uint8_t *, size_t,
+                                                 struct grid *, struct rng *) = {
+  place_random_horizontal,
+  place_random_horizontal_backward,
+  place_random_vertical,
+  place_random_vertical_up,
+  place_random_diagonal_down_right,
+  place_random_diagonal_down_left,
+  place_random_diagonal_up_right,
+  place_random_diagonal_up_left
+};
+
+
+/* Gets the first and last row (or column) a word can start at if it moves
+   by delta for each letter */
+static void
+get_start_range (const int delta, const int len, const int size, int *first,
+                 int *last)
+{
+  *first = delta < 0 ? len - 1 : 0;
+  // unsigned, so the compiler doesn't fold the loops' "row <= last" tests
+  // by assuming that signed arithmetic can't overflow; a word that's longer
+  // than size still gives last < first
+  *last = (int) ((unsigned) size - (delta > 0 ? (unsigned) len : 1u));
+  return;
+}
+
+
+/*!
+ * Checks every starting point in every direction, then places the word at
+ * one of the places it fits, picked uniformly at random (reservoir sampling,
+ * so the candidates don't need to be stored)
+ * @return 0 if the word was placed, -1 if it doesn't fit anywhere
+ */
+static int
+place_exhaustive (dir_op * dir_op, const uint8_t *word, const size_t len,
+                  struct grid *puzzle, struct rng *rng)
+{
+  unsigned long n_found = 0;
+  int chosen_dir = 0, chosen_row = 0, chosen_col = 0;
+  int d;
+  for (d = 0; d < N_DIRECTIONS; d++)
+  {
+    int first_row, last_row, first_col, last_col;
+    get_start_range (dir_op[d].row, len, puzzle->rows, &first_row, &last_row);
+    get_start_range (dir_op[d].col, len, puzzle->cols, &first_col, &last_col);
+    const ptrdiff_t step = dir_op[d].row * (ptrdiff_t) puzzle->stride + dir_op[d].col;
+
+    // FITS_RUN starting points at a time, in the same order as one by one.
+    // The last run of a row can go past last_col; those bits are cleared.
+    int row, col;
+    for (row = first_row; row <= last_row; row++)
+      for (col = first_col; col <= last_col; col += FITS_RUN)
+      {
+        uint32_t fits = fits_run (&CELL (puzzle, row, col), step, word, len);
+        if (last_col - col < FITS_RUN - 1)
+          fits &= UINT32_MAX >> (FITS_RUN - 1 - (last_col - col));
+        for (; fits != 0; fits &= fits - 1)
+          if (rng_below (rng, ++n_found) == 0)
+          {
+            chosen_dir = d;
+            chosen_row = row;
+            chosen_col = col + __builtin_ctz (fits);
+          }
+      }
+  }
+
+  if (n_found == 0)
+    return -1;
+  dir_op[chosen_dir].begin_row = chosen_row;
+  dir_op[chosen_dir].begin_col = chosen_col;
+  return placer (&dir_op[chosen_dir], word, len, puzzle);
+}
+
+
+/* Bits of a row of the bitboard that are used but don't hold the letter
+   (plane is NULL if the letter isn't in the alphabet) */
+static inline uint64_t
+get_conflicts (const uint64_t *occ, const uint64_t *plane, const size_t k)
+{
+  return occ[k] & (plane != NULL ? ~plane[k] : ~UINT64_C (0));
+}
+
+
+/*!
+ * Finds every column in one row where the word fits, going in the direction
+ * of dir_op
+ * @param[in] letters the word's letter indexes
+ * @param[out] fits bit c is set if the word fits starting at (row, c)
+ * @return the number of columns where the word fits
+ */
+static unsigned long
+bitboard_fits (const struct bitboard *bits, const int rows, const int row,
+               const dir_op * dir_op, const int *letters, const size_t len,
+               const int first_col, const int last_col, uint64_t *fits)
+{
+  const size_t n_words = bits->row_words;
+  const size_t plane_size = rows * n_words;
+  size_t k;
+  for (k = 0; k < n_words; k++)
+    fits[k] = 0;
+
+  // Letter i lands in row (row + i * dir_op->row) and column
+  // (c + i * dir_op->col). The word can't start at c if that cell is used by
+  // a different letter, so shifting each letter's conflicts by
+  // i * dir_op->col and OR-ing them together gives every bad column.
+  size_t i;
+  for (i = 0; i < len; i++)
+  {
+    const size_t offset = (row + (int) i * dir_op->row) * n_words;
+    const uint64_t *occ = bits->occ + offset;
+    const uint64_t *plane =
+      letters[i] >= 0 ? bits->planes + letters[i] * plane_size + offset : NULL;
+    const size_t q = i / 64;
+    const unsigned b = i % 64;
+    for (k = 0; k < n_words; k++)
+    {
+      uint64_t bad;
+      if (dir_op->col == 0)
+        bad = get_conflicts (occ, plane, k);
+      else if (dir_op->col > 0)
+      {
+        if (k + q >= n_words)
+          break;
+        bad = get_conflicts (occ, plane, k + q) >> b;
+        if (b != 0 && k + q + 1 < n_words)
+          bad |= get_conflicts (occ, plane, k + q + 1) << (64 - b);
+      }
+      else
+      {
+        if (k < q)
+          continue;
+        bad = get_conflicts (occ, plane, k - q) << b;
+        if (b != 0 && k >= q + 1)
+          bad |= get_conflicts (occ, plane, k - q - 1) >> (64 - b);
+      }
+      fits[k] |= bad;
+    }
+  }
+
+  unsigned long n_fits = 0;
+  for (k = 0; k < n_words; k++)
+  {
+    const int lo = k * 64;
+    const int hi = lo + 63;
+    if (hi < first_col || lo > last_col)
+      fits[k] = 0;
+    else
+    {
+      fits[k] = ~fits[k];
+      if (lo < first_col)
+        fits[k] &= ~UINT64_C (0) << (first_col - lo);
+      if (hi > last_col)
+        fits[k] &= ~UINT64_C (0) >> (hi - last_col);
+    }
+    n_fits += __builtin_popcountll (fits[k]);
+  }
+  return n_fits;
+}
+
+
+/*!
+ * Does the same as place_exhaustive, but the word is checked against every
+ * column of a row at once using the bitboard
+ * @return 0 if the word was placed, -1 if it doesn't fit anywhere
+ */
+static int
+place_bitboard (dir_op * dir_op, const uint8_t *word, const size_t len,
+                struct grid *puzzle, struct rng *rng)
+{
+  const struct bitboard *bits = puzzle->bits;
+  int *letters = malloc (len * sizeof *letters);
+  uint64_t *fits = malloc (bits->row_words * sizeof *fits);
+  fail (letters == NULL || fits == NULL, "Error allocating memory\n");
+  size_t i;
+  for (i = 0; i < len; i++)
+    letters[i] = word[i] < MAX_ALPHABET_LEN ? word[i] : -1;
+
+  unsigned long n_found = 0;
+  int chosen_dir = 0, chosen_row = 0, chosen_col = 0;
+  int d;
+  for (d = 0; d < N_DIRECTIONS; d++)
+  {
+    int first_row, last_row, first_col, last_col;
+    get_start_range (dir_op[d].row, len, puzzle->rows, &first_row, &last_row);
+    get_start_range (dir_op[d].col, len, puzzle->cols, &first_col, &last_col);
+    if (first_col > last_col)
+      continue;
+
+    int row;
+    for (row = first_row; row <= last_row; row++)
+    {
+      const unsigned long n_row =
+        bitboard_fits (bits, puzzle->rows, row, &dir_op[d], letters, len,
+                       first_col, last_col, fits);
+      if (n_row == 0)
+        continue;
+
+      // Same as reservoir sampling one column at a time: one of this row's
+      // n_row columns replaces the current choice with probability
+      // n_row / n_found
+      n_found += n_row;
+      if (rng_below (rng, n_found) >= n_row)
+        continue;
+      unsigned long j = rng_below (rng, n_row);
+      size_t k;
+      for (k = 0; j >= (unsigned long) __builtin_popcountll (fits[k]); k++)
+        j -= __builtin_popcountll (fits[k]);
+      uint64_t w = fits[k];
+      while (j-- > 0)
+        w &= w - 1;
+      chosen_dir = d;
+      chosen_row = row;
+      chosen_col = k * 64 + __builtin_ctzll (w);
+    }
+  }
+  free (letters);
+  free (fits);
+
+  if (n_found == 0)
+    return -1;
+  dir_op[chosen_dir].begin_row = chosen_row;
+  dir_op[chosen_dir].begin_col = chosen_col;
+  return placer (&dir_op[chosen_dir], word, len, puzzle);
+}
+
+
+// How many search nodes '--dense' visits per puzzle, unless it's given a
+// number; each node checks every place one word fits
+#define DENSE_NODES 5000
+// At each word, '--dense' only tries the places that share the most letters
+// with words already in the grid
+#define DENSE_BRANCH 4
+
+struct dense_place
+{
+  // the number of shared letters in the high bits, a random tie-break in
+  // the low ones
+  uint64_t key;
+  int dir;
+  int row;
+  int col;
+};
+
+/* A word that place_dense() tries to place: the places it's tried at, and
+   whether it's at one of them */
+struct dense_frame
+{
+  struct dense_place cands[DENSE_BRANCH];
+  int n_cands;
+  // the next place to try
+  int next;
+  // the word (an index into words)
+  int i;
+  bool placed;
+  // n_filled before the word was placed
+  size_t mark;
+};
+
+// The state of place_dense()
+struct dense_search
+{
+  struct grid *puzzle;
+  const dir_op *dir_op;
+  const uint8_t *const *words;
+  const size_t *lens;
+  int n_words;
+  int target;
+  long nodes_left;
+  // a node was skipped because nodes_left ran out
+  bool out_of_nodes;
+  struct rng *rng;
+  // the words placed so far (indexes into words), and the cells they
+  // filled, so the last placements can be undone
+  int *placed;
+  int n_placed;
+  size_t *filled;
+  size_t n_filled;
+  // the layout with the most words found so far
+  uint8_t *best_cells;
+  int *best;
+  int n_best;
+  // one for each word that's being tried, in order; the search is a loop
+  // over these instead of a recursion, so its depth doesn't use the stack
+  struct dense_frame *frames;
+};
+
+
+/*!
+ * Finds the places where words[i] fits that share the most letters with the
+ * grid, best first
+ * @return the number of places found, at most DENSE_BRANCH
+ */
+static int
+dense_candidates (struct dense_search *s, const int i,
+                  struct dense_place *cands)
+{
+  const struct grid *puzzle = s->puzzle;
+  const uint8_t *word = s->words[i];
+  const size_t len = s->lens[i];
+  int n = 0, d;
+  for (d = 0; d < N_DIRECTIONS; d++)
+  {
+    int first_row, last_row, first_col, last_col;
+    get_start_range (s->dir_op[d].row, len, puzzle->rows, &first_row, &last_row);
+    get_start_range (s->dir_op[d].col, len, puzzle->cols, &first_col, &last_col);
+    const ptrdiff_t step = s->dir_op[d].row * (ptrdiff_t) puzzle->stride + s->dir_op[d].col;
+
+    int row, col;
+    for (row = first_row; row <= last_row; row++)
+      for (col = first_col; col <= last_col; col += FITS_RUN)
+      {
+        uint32_t fits = fits_run (&CELL (puzzle, row, col), step, word, len);
+        if (last_col - col < FITS_RUN - 1)
+          fits &= UINT32_MAX >> (FITS_RUN - 1 - (last_col - col));
+        for (; fits != 0; fits &= fits - 1)
+        {
+          const int c = col + __builtin_ctz (fits);
+          const uint8_t *cell = &CELL (puzzle, row, c);
+          uint64_t shared = 0;
+          size_t k;
+          for (k = 0; k < len; k++)
+            shared += cell[(ptrdiff_t) k * step] == word[k];
+
+          const uint64_t key = shared << 32 | rng_next (s->rng) >> 32;
+          if (n == DENSE_BRANCH && key <= cands[n - 1].key)
+            continue;
+          int j = n < DENSE_BRANCH ? n++ : n - 1;
+          for (; j > 0 && cands[j - 1].key < key; j--)
+            cands[j] = cands[j - 1];
+          cands[j] = (struct dense_place) { key, d, row, c };
+        }
+      }
+  }
+  return n;
+}
+
+
+enum dense_visit
+{
+  DENSE_FOUND,     // target words are placed
+  DENSE_BACK,      // nothing more to try from here
+  DENSE_TRY        // the frame has the places to try the word at
+};
+
+
+/*!
+ * Visits the search node of words[i]: keeps the layout if it has the most
+ * words so far, then finds the places to try the word at
+ * @param[out] f the frame of the word, filled in for DENSE_TRY
+ */
+static enum dense_visit
+dense_visit (struct dense_search *s, const int i, struct dense_frame *f)
+{
+  struct grid *puzzle = s->puzzle;
+  if (s->n_placed > s->n_best)
+  {
+    memcpy (s->best_cells, puzzle->cells, (size_t) puzzle->rows * puzzle->stride);
+    memcpy (s->best, s->placed, s->n_placed * sizeof *s->best);
+    s->n_best = s->n_placed;
+  }
+  if (s->n_placed == s->target)
+    return DENSE_FOUND;
+  // stop when the words that are left can't make a layout with more words
+  // than the best one, or when the budget is spent
+  if (s->n_placed + s->n_words - i <= s->n_best)
+    return DENSE_BACK;
+  if (s->nodes_left <= 0)
+  {
+    s->out_of_nodes = true;
+    return DENSE_BACK;
+  }
+  s->nodes_left--;
+
+  f->n_cands = dense_candidates (s, i, f->cands);
+  f->next = 0;
+  f->i = i;
+  f->placed = false;
+  return DENSE_TRY;
+}
+
+
+/* Puts the word of f at its next place */
+static void
+dense_place_next (struct dense_search *s, struct dense_frame *f)
+{
+  struct grid *puzzle = s->puzzle;
+  const struct dense_place *cand = &f->cands[f->next++];
+  const dir_op *op = &s->dir_op[cand->dir];
+  const ptrdiff_t step = op->row * (ptrdiff_t) puzzle->stride + op->col;
+  const size_t start = (size_t) cand->row * puzzle->stride + cand->col;
+  const uint8_t *word = s->words[f->i];
+  f->mark = s->n_filled;
+  size_t k;
+  for (k = 0; k < s->lens[f->i]; k++)
+  {
+    const size_t pos = start + (ptrdiff_t) k * step;
+    if (puzzle->cells[pos] == EMPTY_CELL)
+    {
+      puzzle->cells[pos] = word[k];
+      s->filled[s->n_filled++] = pos;
+    }
+  }
+  s->placed[s->n_placed++] = f->i;
+  f->placed = true;
+  return;
+}
+
+
+/* Takes the word of f out of the grid; only the cells it filled are
+   emptied, the letters it shared belong to other words */
+static void
+dense_undo (struct dense_search *s, struct dense_frame *f)
+{
+  while (s->n_filled > f->mark)
+    s->puzzle->cells[s->filled[--s->n_filled]] = EMPTY_CELL;
+  s->n_placed--;
+  f->placed = false;
+  return;
+}
+
+
+/*!
+ * Tries each word at the best few places, then leaves it out, and goes on
+ * with the next word from each of those (depth first)
+ * @return true once s->target words are placed
+ */
+static bool
+dense_search_run (struct dense_search *s)
+{
+  int depth = 0, i = 0;
+  while (1)
+  {
+    const enum dense_visit v = dense_visit (s, i, &s->frames[depth]);
+    if (v == DENSE_FOUND)
+      return true;
+    if (v == DENSE_TRY)
+      depth++;
+
+    // back at the last word that's being tried: its next place, or once
+    // they're all tried, the same word left out, whose search takes the
+    // word's frame
+    if (depth == 0)
+      return false;
+    struct dense_frame *f = &s->frames[depth - 1];
+    if (f->placed)
+      dense_undo (s, f);
+    i = f->i + 1;
+    if (f->next < f->n_cands)
+      dense_place_next (s, f);
+    else
+      depth--;
+  }
+}
+
+
+/*!
+ * Places up to target of the words, in their order, backtracking when a
+ * word doesn't fit. Places that share letters with the words already in the
+ * grid are tried first, so the words overlap as much as they can.
+ * @param[in] words the words' symbols (see grid_encode)
+ * @param[in] budget the number of search nodes to visit at most, which
+ * bounds the time taken
+ * @param[out] placed the indexes of the words placed, in order
+ * @param[out] out_of_nodes set if the budget ran out before the search
+ * was over
+ * @return the number of words placed. The grid has the layout with the
+ * most words found within the budget.
+ */
+int
+place_dense (dir_op * dir_op, const uint8_t *const *words,
+             const size_t *lens, const int n_words, const int target,
+             const long budget, struct grid *puzzle, struct rng *rng,
+             int *placed, bool *out_of_nodes)
+{
+  const size_t n_cells = (size_t) puzzle->rows * puzzle->stride;
+  struct dense_search s = {
+    .puzzle = puzzle,
+    .dir_op = dir_op,
+    .words = words,
+    .lens = lens,
+    .n_words = n_words,
+    .target = target,
+    .nodes_left = budget,
+    .rng = rng,
+    .placed = malloc ((n_words + 1) * sizeof *s.placed),
+    .filled = malloc (n_cells * sizeof *s.filled),
+    .best_cells = malloc (n_cells),
+    .best = placed,
+    .frames = calloc (n_words + 1, sizeof *s.frames)
+  };
+  fail (s.placed == NULL || s.filled == NULL || s.best_cells == NULL
+        || s.frames == NULL, "Error allocating memory\n");
+  memcpy (s.best_cells, puzzle->cells, n_cells);
+
+  *out_of_nodes = !dense_search_run (&s) && s.out_of_nodes;
+  memcpy (puzzle->cells, s.best_cells, n_cells);
+
+  free (s.placed);
+  free (s.filled);
+  free (s.best_cells);
+  free (s.frames);
+  return s.n_best;
+}
+
+
+// Output is put together here, then written with a single call
+struct out_buf
+{
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+
+/*!
+ * Makes room for n more bytes in buf
+ * @return void
+ */
+static void
+out_buf_reserve (struct out_buf *buf, const size_t n)
+{
+  if (buf->len + n <= buf->cap)
+    return;
+  size_t cap = buf->cap ? buf->cap * 2 : 4096;
+  while (cap < buf->len + n)
+    cap *= 2;
+  char *data = realloc (buf->data, cap);
+  if (data == NULL)
+  {
+    fputs ("Error allocating memory\n", stderr);
+    exit (EXIT_FAILURE);
+  }
+  buf->data = data;
+  buf->cap = cap;
+  return;
+}
+
+
+static void
+out_buf_add (struct out_buf *buf, const char *str, const size_t n)
+{
+  out_buf_reserve (buf, n);
+  memcpy (buf->data + buf->len, str, n);
+  buf->len += n;
+  return;
+}
+
+
+void
+out_buf_free (struct out_buf *buf)
+{
+  free (buf->data);
+  buf->data = NULL;
+  buf->len = buf->cap = 0;
+  return;
+}
+
+
+/*!
+ * Encodes a character as UTF-8
+ * @param[out] out room for at least 4 bytes
+ * @return the number of bytes used
+ */
+size_t
+utf8_encode (char *out, const wchar_t c)
+{
+  const uint32_t u = c;
+  if (u < 0x80)
+  {
+    out[0] = u;
+    return 1;
+  }
+  if (u < 0x800)
+  {
+    out[0] = 0xC0 | (u >> 6);
+    out[1] = 0x80 | (u & 0x3F);
+    return 2;
+  }
+  if (u < 0x10000)
+  {
+    out[0] = 0xE0 | (u >> 12);
+    out[1] = 0x80 | ((u >> 6) & 0x3F);
+    out[2] = 0x80 | (u & 0x3F);
+    return 3;
+  }
+  out[0] = 0xF0 | (u >> 18);
+  out[1] = 0x80 | ((u >> 12) & 0x3F);
+  out[2] = 0x80 | ((u >> 6) & 0x3F);
+  out[3] = 0x80 | (u & 0x3F);
+  return 4;
+}
+
+
+/*!
+ * Adds len characters of str to buf, encoded as UTF-8
+ * @return void
+ */
+static void
+out_buf_add_wcs (struct out_buf *buf, const wchar_t *str, const size_t len)
+{
+  out_buf_reserve (buf, len * 4);
+  size_t i;
+  for (i = 0; i < len; i++)
+    buf->len += utf8_encode (buf->data + buf->len, str[i]);
+  return;
+}
+
+
+/*!
+ * Prints a word as UTF-8 (whatever the locale is) between two strings
+ * @return void
+ */
+static void
+print_word (FILE * restrict stream, const char *before, const wchar_t *word,
+            const size_t len, const char *after)
+{
+  char out[4];
+  size_t i;
+  fputs (before, stream);
+  for (i = 0; i < len; i++)
+    fwrite (out, 1, utf8_encode (out, word[i]), stream);
+  fputs (after, stream);
+  return;
+}
+
+
+/*!
+ * Adds the grid to buf, one line per row
+ * @param[in] cells puzzle->cells or puzzle->filled
+ * @return void
+ */
+static void
+render_grid (struct out_buf *buf, const struct grid *puzzle,
+             const uint8_t *cells)
+{
+  // each symbol encoded once; an empty cell is shown as fill_char
+  char glyph[UINT8_MAX + 1][4];
+  uint8_t glyph_len[UINT8_MAX + 1];
+  int i, j;
+  for (i = 0; i < puzzle->n_symbols; i++)
+    glyph_len[i] = utf8_encode (glyph[i], puzzle->symbols[i]);
+  glyph_len[EMPTY_CELL] = utf8_encode (glyph[EMPTY_CELL], fill_char);
+
+  for (i = 0; i < puzzle->rows; i++)
+  {
+    // at most 4 bytes and a space for each cell, and the newline
+    out_buf_reserve (buf, (size_t) puzzle->cols * 5 + 1);
+    char *out = buf->data + buf->len;
+    const uint8_t *cell = cells + (size_t) i * puzzle->stride;
+    for (j = 0; j < puzzle->cols; j++)
+    {
+      memcpy (out, glyph[cell[j]], 4);
+      out += glyph_len[cell[j]];
+      *out++ = ' ';
+    }
+    *out++ = '\n';
+    buf->len = out - buf->data;
+  }
+  return;
+}
+
+
+static void
+render_words (struct out_buf *buf, const struct word_list *words)
+{
+  // The columns are as wide as they always were with the default grid,
+  // unless a longer word was used
+  size_t width = GRID_SIZE - 1;
+  int i = 0;
+  for (i = 0; i < words->n; i++)
+    if (word_list_len (words, i) >= width)
+      width = word_list_len (words, i) + 1;
+
+  i = 0;
+  while (i < words->n)
+  {
+    const size_t len = word_list_len (words, i);
+    out_buf_reserve (buf, width + len * 4);
+    const size_t start = buf->len;
+    out_buf_add_wcs (buf, word_list_get (words, i), len);
+    // the words are right aligned; like printf, the width counts bytes
+    const size_t n_bytes = buf->len - start;
+    if (n_bytes < width)
+    {
+      memmove (buf->data + start + width - n_bytes, buf->data + start, n_bytes);
+      memset (buf->data + start, ' ', width - n_bytes);
+      buf->len = start + width;
+    }
+    i++;
+
+    // start a new row after every 3 words
+    if (i % 3 == 0)
+      out_buf_add (buf, "\n", 1);
+  }
+  out_buf_add (buf, "\n", 1);
+  return;
+}
+
+
+/*!
+ * Prints the answer key, the puzzle (filled in by fill_puzzle()) and the word
+ * list with a single write
+ * @param[in,out] buf where the output is put together; reused between calls
+ * @return void
+ */
+static void
+print_puzzle (FILE * restrict stream, struct out_buf *buf,
+              const struct grid *puzzle, const struct word_list *words)
+{
+  static const char key_header[] = " ==] Answer key [==\n";
+  buf->len = 0;
+  out_buf_add (buf, key_header, sizeof key_header - 1);
+  render_grid (buf, puzzle, puzzle->cells);
+  out_buf_add (buf, "\n\n\n", 3);
+  render_grid (buf, puzzle, puzzle->filled);
+  out_buf_add (buf, "\n", 1);
+  render_words (buf, words);
+  fwrite (buf->data, 1, buf->len, stream);
+  return;
+}
+
+
+/*!
+ * Fills in the row and column operations of each direction. begin_row and
+ * begin_col are written while placing words, so every caller needs its own
+ * copy (e.g. one for each thread)
+ * @param[out] dir_ops an array of N_DIRECTIONS elements
+ * @return void
+ */
+void
+create_dir_op (dir_op *dir_ops)
+{
+  static const dir_op dir_op_init[N_DIRECTIONS] = {
+    {0, 0, HORIZONTAL_NOOP, HORIZONTAL_INC},
+    {0, 0, HORIZONTAL_BACKWARD_NOOP, HORIZONTAL_BACKWARD_DEC},
+    {0, 0, VERTICAL_INC, VERTICAL_NOOP},
+    {0, 0, VERTICAL_UP_DEC, VERTICAL_UP_NOOP},
+    {0, 0, DIAGONAL_DOWN_RIGHT_INC, DIAGONAL_DOWN_RIGHT_INC},
+    {0, 0, DIAGONAL_DOWN_LEFT_INC, DIAGONAL_DOWN_LEFT_DEC},
+    {0, 0, DIAGONAL_UP_RIGHT_DEC, DIAGONAL_UP_RIGHT_INC},
+    {0, 0, DIAGONAL_UP_LEFT_DEC, DIAGONAL_UP_LEFT_DEC}
+  };
+  memcpy (dir_ops, dir_op_init, sizeof dir_op_init);
+  return;
+}
+
+
+/* For long options that have no equivalent short option, use a
+   non-character as a pseudo short option, starting with CHAR_MAX + 1.  */
+enum
+{
+  INPUT_FILE = CHAR_MAX + 1,
+  LANG,
+  COUNT,
+  SERVE,
+  WORKERS,
+  DICT,
+  ROWS,
+  COLS,
+  PLACEMENT,
+  SEED,
+  JOBS,
+  SOLVE,
+  UNIQUE,
+  ORDER,
+  DENSE,
+  WORD_HOST,
+  FETCH_DEADLINE
+};
+
+
+void
+print_usage ()
+{
+  puts ("\n\
+  -h, --help                  show help for command line options\n\
+  -V, --version               show the program version number\n\
+      --lang=LANG             language (optional; defaults to 'en')\n\
+                              available: 'en','de','it','es', or 'all' for\n\
+                              puzzles in each of them, made at the same time\n\
+  -l, --log                   log the output to a file (in addition to stdout)\n\
+      --input-file=FILE       Reads words from plain text file\n\
+      --dict=FILE             pick random words from a word list (one word\n\
+                              per line); an index is saved to FILE.idx\n\
+      --count=N               generate N puzzles (the word list is fetched once\n\
+                              and reused for each puzzle)\n\
+      --serve=PORT            answer 'GET /?lang=LANG' requests with an HTML\n\
+                              puzzle page instead of printing a puzzle\n\
+      --workers=N             number of server processes (defaults to 4)\n\
+      --rows=N                number of rows in the puzzle (defaults to 20)\n\
+      --cols=N                number of columns in the puzzle (defaults to 20)\n\
+      --placement=HOW         'random' (default) tries random starting points;\n\
+                              'exhaustive' checks every place a word fits;\n\
+                              'bitboard' does the same using bit masks\n\
+      --order=HOW             'given' (default) tries the words in the order\n\
+                              they were fetched; 'longest' tries the longest\n\
+                              words first, while there's still room for them\n\
+      --dense[=N]             place the words so they share as many letters\n\
+                              as they can, going back to move earlier words\n\
+                              when one doesn't fit; at most N (defaults to\n\
+                              5000) steps per puzzle\n\
+      --host=HOST             fetch the words from HOST (a host name, with\n\
+                              an optional port and 'http://' in front)\n\
+                              instead of the default; can be given up to 8\n\
+                              times\n\
+      --fetch-deadline=MS     ask all the hosts at once and use the first\n\
+                              answer; if none comes within MS milliseconds,\n\
+                              use the words in --dict instead\n\
+      --seed=N                seed for the random number generator; the same\n\
+                              seed and word list give the same puzzles\n\
+      --jobs=N                generate the puzzles on N threads (defaults\n\
+                              to 1); the output doesn't depend on N\n\
+      --solve=FILE            find the words in a puzzle: FILE has the rows\n\
+                              of the grid, an empty line, then the words\n\
+      --unique                change filler letters that spell one of the\n\
+                              words a second time");
+}
+
+static inline int
+write_log (const struct word_list *words, const struct grid *puzzle,
+           const uint64_t seed, const char *lang, const int puzzle_no,
+           struct out_buf *buf)
+{
+  {
+    // lang is NULL and puzzle_no is 0 when only one puzzle is generated, so
+    // the file names stay the same as they were before '--count' and
+    // '--lang=all' were added
+    char suffix[64] = "";
+    snprintf (suffix, sizeof suffix, "%s%s", lang != NULL ? "_" : "",
+              lang != NULL ? lang : "");
+    if (puzzle_no > 0)
+      snprintf (suffix + strlen (suffix), sizeof suffix - strlen (suffix),
+                "_%d", puzzle_no);
+
+    char log_file[BUFSIZ];
+    snprintf (log_file, BUFSIZ, "aawordsearch_%" PRIu64 "%s.log", seed, suffix);
+    FILE *fp = fopen (log_file, "w");
+    if (fp != NULL)
+    {
+      fprintf (fp, "seed = %" PRIu64 "\n\n", seed);
+      print_puzzle (fp, buf, puzzle, words);
+    }
+    else
+    {
+      fputs ("Error while opening ", stderr);
+      perror (log_file);
+      return -1;
+    }
+
+    if (fclose (fp) != 0)
+      fprintf (stderr, "Error closing %s\n", log_file);
+
+    char word_log_file[BUFSIZ];
+    snprintf (word_log_file, BUFSIZ, "aawordsearch_words_%" PRIu64 "%s.log", seed, suffix);
+    fp = fopen (word_log_file, "w");
+    if (fp != NULL)
+    {
+      int l = 0;
+      while (l < words->n)
+      {
+        print_word (fp, "", word_list_get (words, l), word_list_len (words, l), "\n");
+        l++;
+      }
+    }
+    if (fclose (fp) != 0)
+      fprintf (stderr, "Error closing %s\n", log_file);
+  }
+  return 0;
+}
+
+
+// With --jobs, puzzles are handed out to the threads in batches of this size.
+// Batch b holds puzzles b * JOB_BATCH_SIZE + 1 to (b + 1) * JOB_BATCH_SIZE.
+#define JOB_BATCH_SIZE 4
+
+/*
+ * The batches that belong to one thread. Thread t of n starts out with
+ * batches t, t + n, t + 2 * n..., so the first batches (which have to be
+ * printed first) are spread over all the threads. The thread takes batches
+ * from the front; when it runs out, it steals from the back of the others.
+ */
+struct job_queue
+{
+  pthread_mutex_t lock;
+  // batch t + i * n, for first <= i < end
+  int first;
+  int end;
+};
+
+
+/*!
+ * Divides n_batches batches over n_queues queues
+ * @return void
+ */
+void
+job_queues_init (struct job_queue *queues, const int n_queues, const int n_batches)
+{
+  int t;
+  for (t = 0; t < n_queues; t++)
+  {
+    pthread_mutex_init (&queues[t].lock, NULL);
+    queues[t].first = 0;
+    queues[t].end = t < n_batches ? (n_batches - t - 1) / n_queues + 1 : 0;
+  }
+  return;
+}
+
+
+/*!
+ * @return void
+ */
+void
+job_queues_destroy (struct job_queue *queues, const int n_queues)
+{
+  int t;
+  for (t = 0; t < n_queues; t++)
+    pthread_mutex_destroy (&queues[t].lock);
+  return;
+}
+
+
+/*!
+ * Takes the lowest batch from queue self, or steals the highest batch from
+ * one of the other queues if self is empty
+ * @return the batch number, or -1 if all the queues are empty
+ */
+int
+job_queue_take (struct job_queue *queues, const int n_queues, const int self)
+{
+  int i;
+  for (i = 0; i < n_queues; i++)
+  {
+    const int t = (self + i) % n_queues;
+    struct job_queue *queue = &queues[t];
+    int batch = -1;
+    pthread_mutex_lock (&queue->lock);
+    if (queue->first < queue->end)
+    {
+      if (t == self)
+        batch = t + queue->first++ * n_queues;
+      else
+        batch = t + --queue->end * n_queues;
+    }
+    pthread_mutex_unlock (&queue->lock);
+    if (batch >= 0)
+      return batch;
+  }
+  return -1;
+}
+
+
+/*
+ * An Aho-Corasick automaton that finds all the words of a word list in one
+ * pass over a line of the grid. The characters used in the words are
+ * numbered 1 to n_symbols - 1; 0 stands for any other character. Every
+ * state has a transition for every symbol, so each cell is one table lookup.
+ */
+struct matcher
+{
+  // the characters used in the words, sorted; chars[i] is symbol i + 1
+  wchar_t *chars;
+  int n_symbols;
+  int n_states;
+  int cap;
+  // n_states * n_symbols transitions
+  int *next;
+  // the word that ends in each state, or -1
+  int *word;
+  // the nearest state on the failure chain where a word ends, or -1
+  int *out_link;
+  // for each word, true if it reads the same backwards
+  bool *palindrome;
+  // for each word, the state where it ends; a word that's in the list twice
+  // only belongs to that state the first time
+  int *word_state;
+};
+
+// One place where a word was found
+struct match
+{
+  int word;
+  int row;
+  int col;
+  // an index into the dir_op table
+  int dir;
+};
+
+
+static int
+cmp_wchar (const void *a, const void *b)
+{
+  const wchar_t x = *(const wchar_t *) a, y = *(const wchar_t *) b;
+  return (x > y) - (x < y);
+}
+
+
+/*!
+ * @return the symbol of c, or 0 if none of the words uses it
+ */
+static int
+matcher_symbol (const struct matcher *m, const wchar_t c)
+{
+  const wchar_t *found = bsearch (&c, m->chars, m->n_symbols - 1,
+                                  sizeof *m->chars, cmp_wchar);
+  return found != NULL ? found - m->chars + 1 : 0;
+}
+
+
+static int
+matcher_new_state (struct matcher *m)
+{
+  if (m->n_states == m->cap)
+  {
+    const int cap = m->cap ? m->cap * 2 : 256;
+    int *next = realloc (m->next, (size_t) cap * m->n_symbols * sizeof *next);
+    int *word = realloc (m->word, cap * sizeof *word);
+    int *out_link = realloc (m->out_link, cap * sizeof *out_link);
+    fail (next == NULL || word == NULL || out_link == NULL,
+          "Error allocating memory\n");
+    m->next = next;
+    m->word = word;
+    m->out_link = out_link;
+    m->cap = cap;
+  }
+  const int s = m->n_states++;
+  memset (&m->next[(size_t) s * m->n_symbols], 0, m->n_symbols * sizeof *m->next);
+  m->word[s] = -1;
+  m->out_link[s] = -1;
+  return s;
+}
+
+
+/*!
+ * Builds the automaton for the words (which should be upper case, like the
+ * grid)
+ * @return void
+ */
+void
+matcher_build (struct matcher *m, const struct word_list *words)
+{
+  memset (m, 0, sizeof *m);
+
+  // collect the characters
+  size_t n_chars = 0;
+  int i;
+  for (i = 0; i < words->n; i++)
+    n_chars += word_list_len (words, i);
+  m->chars = malloc ((n_chars + 1) * sizeof *m->chars);
+  m->palindrome = malloc ((words->n + 1) * sizeof *m->palindrome);
+  m->word_state = malloc ((words->n + 1) * sizeof *m->word_state);
+  fail (m->chars == NULL || m->palindrome == NULL || m->word_state == NULL,
+        "Error allocating memory\n");
+  n_chars = 0;
+  for (i = 0; i < words->n; i++)
+  {
+    wmemcpy (m->chars + n_chars, word_list_get (words, i), word_list_len (words, i));
+    n_chars += word_list_len (words, i);
+  }
+  qsort (m->chars, n_chars, sizeof *m->chars, cmp_wchar);
+  size_t j, n_unique = 0;
+  for (j = 0; j < n_chars; j++)
+    if (n_unique == 0 || m->chars[j] != m->chars[n_unique - 1])
+      m->chars[n_unique++] = m->chars[j];
+  m->n_symbols = n_unique + 1;
+
+  // the trie; state 0 is the root, so a transition to 0 means "none yet"
+  matcher_new_state (m);
+  for (i = 0; i < words->n; i++)
+  {
+    const wchar_t *word = word_list_get (words, i);
+    const size_t len = word_list_len (words, i);
+    int s = 0;
+    for (j = 0; j < len; j++)
+    {
+      const size_t t = (size_t) s * m->n_symbols + matcher_symbol (m, word[j]);
+      if (m->next[t] == 0)
+      {
+        const int new_state = matcher_new_state (m);
+        m->next[t] = new_state;
+      }
+      s = m->next[t];
+    }
+    if (m->word[s] < 0 && len > 0)
+      m->word[s] = i;
+    m->word_state[i] = s;
+    m->palindrome[i] = true;
+    for (j = 0; j < len / 2; j++)
+      if (word[j] != word[len - 1 - j])
+        m->palindrome[i] = false;
+  }
+
+  // Number the states breadth first, so the states near the root (where
+  // most of the time is spent) are next to each other in memory
+  const size_t n_symbols = m->n_symbols;
+  int *order = malloc (m->n_states * sizeof *order);
+  int *new_id = malloc (m->n_states * sizeof *new_id);
+  int *next = malloc (m->n_states * n_symbols * sizeof *next);
+  int *word = malloc (m->n_states * sizeof *word);
+  fail (order == NULL || new_id == NULL || next == NULL || word == NULL,
+        "Error allocating memory\n");
+  int head = 0, tail = 1;
+  size_t c;
+  order[0] = 0;
+  new_id[0] = 0;
+  while (head < tail)
+  {
+    const int s = order[head++];
+    for (c = 0; c < n_symbols; c++)
+    {
+      const int t = m->next[s * n_symbols + c];
+      if (t != 0)
+      {
+        new_id[t] = tail;
+        order[tail++] = t;
+      }
+    }
+  }
+  int s;
+  for (s = 0; s < m->n_states; s++)
+  {
+    const int old = order[s];
+    word[s] = m->word[old];
+    for (c = 0; c < n_symbols; c++)
+    {
+      const int t = m->next[old * n_symbols + c];
+      next[s * n_symbols + c] = t != 0 ? new_id[t] : 0;
+    }
+  }
+  for (i = 0; i < words->n; i++)
+    m->word_state[i] = new_id[m->word_state[i]];
+  free (m->next);
+  free (m->word);
+  m->next = next;
+  m->word = word;
+
+  // Now the states are in breadth first order, so the failure state of a
+  // state (the longest proper suffix that's also in the trie) is finished
+  // before it's needed. Missing transitions are copied from the failure
+  // state.
+  int *fail_state = new_id;
+  for (c = 0; c < n_symbols; c++)
+    if (next[c] != 0)
+      fail_state[next[c]] = 0;
+  for (s = 1; s < m->n_states; s++)
+  {
+    const int f = fail_state[s];
+    m->out_link[s] = m->word[f] >= 0 ? f : m->out_link[f];
+    for (c = 0; c < n_symbols; c++)
+    {
+      int *t = &next[s * n_symbols + c];
+      const int via_fail = next[f * n_symbols + c];
+      if (*t != 0)
+        fail_state[*t] = via_fail;
+      else
+        *t = via_fail;
+    }
+  }
+  free (order);
+  free (new_id);
+  return;
+}
+
+
+void
+matcher_free (struct matcher *m)
+{
+  free (m->chars);
+  free (m->next);
+  free (m->word);
+  free (m->out_link);
+  free (m->palindrome);
+  free (m->word_state);
+  return;
+}
+
+
+/*!
+ * Finds every occurrence of the words in cells (puzzle->cells or
+ * puzzle->filled). Each line of the grid is scanned once in each of the
+ * directions of the dir_op table.
+ * A word that reads the same backwards is only reported in one direction of
+ * each pair, and a one letter word only in the first direction, so every
+ * set of cells is reported once.
+ * @param[in,out] matches grown with realloc; *cap is its size
+ * @return the number of matches
+ */
+int
+find_words (const struct matcher *m, const struct word_list *words,
+            const struct grid *puzzle, const uint8_t *cells,
+            const dir_op *dir_op, struct match **matches, int *cap)
+{
+  // the matcher's symbol for each of the grid's
+  int symbol_of[UINT8_MAX + 1];
+  int sym;
+  for (sym = 0; sym < puzzle->n_symbols; sym++)
+    symbol_of[sym] = matcher_symbol (m, puzzle->symbols[sym]);
+  symbol_of[EMPTY_CELL] = matcher_symbol (m, fill_char);
+
+  int *symbols = malloc ((size_t) puzzle->rows * puzzle->cols * sizeof *symbols);
+  fail (symbols == NULL, "Error allocating memory\n");
+  int row, col;
+  for (row = 0; row < puzzle->rows; row++)
+    for (col = 0; col < puzzle->cols; col++)
+      symbols[(size_t) row * puzzle->cols + col] =
+        symbol_of[cells[(size_t) row * puzzle->stride + col]];
+
+  // The state of each line. The grid is read one row at a time (in the
+  // direction of dr), so the cells are read in the order they're stored;
+  // c * dr - r * dc is the same for every cell (r, c) of a line.
+  int *states = malloc ((puzzle->rows + puzzle->cols) * sizeof *states);
+  fail (states == NULL, "Error allocating memory\n");
+  int n = 0;
+  int d;
+  for (d = 0; d < N_DIRECTIONS; d++)
+  {
+    const int dr = dir_op[d].row, dc = dir_op[d].col;
+    const bool forward = dr > 0 || (dr == 0 && dc > 0);
+    // makes the smallest c * dr - r * dc 0
+    const int offset = -((dr < 0 ? (puzzle->cols - 1) * dr : 0)
+                         + (dc > 0 ? -(puzzle->rows - 1) * dc : 0));
+    memset (states, 0, (puzzle->rows + puzzle->cols) * sizeof *states);
+    int i, j;
+    for (i = 0; i < puzzle->rows; i++)
+    {
+      const int r = dr < 0 ? puzzle->rows - 1 - i : i;
+      for (j = 0; j < puzzle->cols; j++)
+      {
+        const int c = dc < 0 ? puzzle->cols - 1 - j : j;
+        int *s = &states[c * dr - r * dc + offset];
+        *s = m->next[(size_t) *s * m->n_symbols + symbols[(size_t) r * puzzle->cols + c]];
+        int t;
+        for (t = m->word[*s] >= 0 ? *s : m->out_link[*s]; t >= 0; t = m->out_link[t])
+        {
+          const int w = m->word[t];
+          const int len = word_list_len (words, w);
+          if ((m->palindrome[w] && !forward) || (len == 1 && d != 0))
+            continue;
+          if (n == *cap)
+          {
+            *cap = *cap ? *cap * 2 : 64;
+            struct match *grown = realloc (*matches, *cap * sizeof *grown);
+            fail (grown == NULL, "Error allocating memory\n");
+            *matches = grown;
+          }
+          (*matches)[n].word = w;
+          (*matches)[n].row = r - (len - 1) * dr;
+          (*matches)[n].col = c - (len - 1) * dc;
+          (*matches)[n].dir = d;
+          n++;
+        }
+      }
+      // a horizontal line ends with its row
+      if (dr == 0)
+        states[-r * dc + offset] = 0;
+    }
+  }
+  free (states);
+  free (symbols);
+  return n;
+}
+
+
+// make_unique() gives up after this many rounds
+#define MAX_UNIQUE_ROUNDS 100
+
+/*!
+ * Changes filler letters until each word is only found where it was placed.
+ * Every round scans puzzle->filled for all the words at once; each extra
+ * occurrence that uses a filler cell gets one of those cells changed to
+ * another random letter. Only a few cells change, so it usually takes one
+ * or two rounds.
+ * @param[in] words the words that were placed
+ * @return the number of rounds that changed something, or -1 if there are
+ * still extra occurrences after MAX_UNIQUE_ROUNDS
+ */
+int
+make_unique (struct grid *puzzle, const struct word_list *words,
+             struct rng *rng)
+{
+  // the words the way they were written to the grid
+  struct word_list upper = { 0 };
+  uint8_t *symbols = NULL;
+  int i;
+  for (i = 0; i < words->n; i++)
+  {
+    const size_t len = word_list_len (words, i);
+    const int w = word_list_add (&upper, word_list_get (words, i), len);
+    wchar_t *word = upper.pool + upper.entries[w].offset;
+    symbols = realloc (symbols, len);
+    fail (symbols == NULL, "Error allocating memory\n");
+    // they were placed, so their letters are already in the symbols
+    grid_encode (puzzle, word, len, symbols);
+    size_t c;
+    for (c = 0; c < len; c++)
+      word[c] = puzzle->symbols[symbols[c]];
+  }
+  free (symbols);
+
+  dir_op dir_op[N_DIRECTIONS];
+  create_dir_op (dir_op);
+  struct matcher m;
+  matcher_build (&m, &upper);
+  struct match *matches = NULL;
+  int cap = 0;
+
+  int round;
+  int r = -1;
+  for (round = 0; round < MAX_UNIQUE_ROUNDS && r < 0; round++)
+  {
+    const int n = find_words (&m, &upper, puzzle, puzzle->filled, dir_op,
+                              &matches, &cap);
+    int n_changed = 0;
+    int k;
+    for (k = 0; k < n; k++)
+    {
+      // the filler cells of this occurrence; if there are none, it's where
+      // the word was placed (or it's made of other words, which can't be
+      // helped)
+      const int len = word_list_len (&upper, matches[k].word);
+      const int dr = dir_op[matches[k].dir].row, dc = dir_op[matches[k].dir].col;
+      size_t cell = 0;
+      int n_filler = 0;
+      int l;
+      for (l = 0; l < len; l++)
+      {
+        const size_t at = (size_t) (matches[k].row + l * dr) * puzzle->stride
+          + matches[k].col + l * dc;
+        // pick one of them at random
+        if (puzzle->cells[at] == EMPTY_CELL && rng_below (rng, ++n_filler) == 0)
+          cell = at;
+      }
+      if (n_filler == 0)
+        continue;
+
+      uint8_t letter;
+      do
+        letter = rng_below (rng, puzzle->n_letters);
+      while (letter == puzzle->filled[cell] && puzzle->n_letters > 1);
+      puzzle->filled[cell] = letter;
+      n_changed++;
+    }
+    if (n_changed == 0)
+      r = round;
+  }
+
+  free (matches);
+  matcher_free (&m);
+  word_list_free (&upper);
+  return r;
+}
+
+
+/* Checks that the len bytes at s are valid UTF-8 */
+static bool
+utf8_valid (const unsigned char *s, const size_t len)
+{
+  size_t pos = 0;
+  wchar_t wc;
+  while (pos < len)
+  {
+    const size_t n = utf8_decode (&wc, s + pos, len - pos);
+    if (n == 0)
+      return false;
+    pos += n;
+  }
+  return true;
+}
+
+
+// --input-file is read this many bytes at a time
+#define WORD_FILE_BUF_SIZE (1 << 20)
+
+/*!
+ * Reads the whole word file in one pass and keeps a random sample of the
+ * words that can be used (reservoir sampling), so each of them has the same
+ * chance of being picked, and memory use only depends on the words that are
+ * kept, not on the size of the file
+ * @param[out] list up to max_words words, in no particular order
+ * @return the number of usable words in the file, or -1 on error
+ */
+static int64_t
+read_word_file (const char *path, struct word_list *list, const int max_words,
+                const int max_len, struct rng *rng)
+{
+  const int fd = open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    fputs ("error opening word file: ", stderr);
+    perror (path);
+    return -1;
+  }
+#ifdef POSIX_FADV_SEQUENTIAL
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  wchar_t *word = malloc ((size_t) max_len * sizeof *word);
+  unsigned char *buf = malloc (WORD_FILE_BUF_SIZE);
+  fail (word == NULL || buf == NULL, "Error allocating memory\n");
+
+  // the sample is kept in list; the words that were replaced are left in
+  // its pool until they take up half of it
+  word_list_clear (list);
+  size_t n_dead = 0;
+  uint64_t n_seen = 0;
+  // the start of a line that's cut off by the end of the last read
+  size_t kept = 0;
+  // the line is longer than the buffer, so it can't be a word
+  bool skip = false;
+  // what's known about the line so far: its characters, the spaces and dots
+  // in it and the bits of its bytes
+  size_t n_chars = 0, n_bad = 0;
+  unsigned high = 0;
+  ssize_t n;
+  do
+  {
+    n = read (fd, buf + kept, WORD_FILE_BUF_SIZE - kept);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      fputs ("Error reading file: ", stderr);
+      perror (path);
+      break;
+    }
+
+    // at the end of the file, the last line doesn't need a newline
+    size_t size = kept + n;
+    if (n == 0 && kept > 0)
+      buf[size++] = '\n';
+
+    // one pass over the bytes: the lines are checked as they're found,
+    // so only the words that go in the sample are decoded. Each character
+    // has one byte that isn't a continuation byte (10xxxxxx), which is
+    // enough to count them; only a line with bytes over 0x7F is checked for
+    // bad UTF-8, and only if it could be used.
+    size_t start = 0, pos;
+    // the bytes that were kept from the last read were already looked at
+    for (pos = kept; pos < size; pos++)
+    {
+      const unsigned char c = buf[pos];
+      if (c != '\n')
+      {
+        n_chars += (c & 0xC0) != 0x80;
+        n_bad += c == ' ' || c == '.';
+        high |= c;
+        continue;
+      }
+
+      const unsigned char *line = buf + start;
+      size_t len = pos - start;
+      start = pos + 1;
+      // trailing white space isn't part of the word
+      while (len > 0 && isspace (line[len - 1]))
+      {
+        n_chars--;
+        n_bad -= line[len - 1] == ' ';
+        len--;
+      }
+      const size_t n_line = n_chars;
+      const bool usable = !skip && n_chars > 0 && n_chars <= (size_t) max_len
+        && n_bad == 0 && ((high & 0x80) == 0 || utf8_valid (line, len));
+      n_chars = n_bad = 0;
+      high = 0;
+      skip = false;
+      if (!usable)
+        continue;
+
+      // the first max_words words fill the sample; after that, the nth word
+      // takes the place of one of them with a chance of max_words / n
+      const uint64_t i = n_seen < (uint64_t) max_words
+        ? n_seen : rng_below_small (rng, n_seen + 1);
+      n_seen++;
+      if (i < (uint64_t) max_words)
+      {
+        size_t byte, w;
+        for (w = 0, byte = 0; w < n_line; w++)
+          byte += utf8_decode (&word[w], line + byte, len - byte);
+        if (i == (uint64_t) list->n)
+          word_list_add (list, word, n_line);
+        else
+        {
+          n_dead += word_list_len (list, i) + 1;
+          word_list_replace (list, i, word, n_line);
+          if (n_dead > list->pool_len / 2)
+          {
+            word_list_compact (list);
+            n_dead = 0;
+          }
+        }
+      }
+    }
+
+    kept = size - start;
+    if (kept == WORD_FILE_BUF_SIZE)
+    {
+      kept = 0;
+      skip = true;
+    }
+    else
+      memmove (buf, buf + start, kept);
+  }
+  while (n != 0);
+  close (fd);
+  free (buf);
+  free (word);
+  return n < 0 ? -1 : (int64_t) n_seen;
+}
+
+
+#ifndef TEST
+// Longest word (in characters) kept in a dictionary index
+#define DICT_MAX_LEN 64
+#define DICT_MAGIC "AAWSIDX1"
+
+/*
+ * The index file is a header followed by the byte offsets of the lines in
+ * the word list. The offsets are sorted by language, then by length, so the
+ * words of one language with length <= n are one contiguous range and a
+ * random word can be picked without looking at the word list itself.
+ */
+struct dict_index_header
+{
+  char magic[8];
+  uint64_t dict_size;
+  int64_t dict_mtime;
+  // e.g. "en,de,it,es"; a word is indexed once for each language whose
+  // alphabet has all of its letters
+  char langs[64];
+  uint64_t n_offsets;
+};
+
+struct dict
+{
+  const unsigned char *data;
+  size_t size;
+  void *idx;
+  size_t idx_size;
+  bool idx_mapped;
+  int n_langs;
+  // words of language l with length n are
+  // offsets[bucket_start[l * (DICT_MAX_LEN + 1) + n] ... bucket_start[... + n + 1]]
+  const uint64_t *bucket_start;
+  const uint64_t *offsets;
+};
+
+
+static int
+count_langs (const struct lang_vars *st_langvars)
+{
+  int n = 0;
+  while (st_langvars[n].lang != NULL)
+    n++;
+  return n;
+}
+
+
+static size_t
+dict_index_size (const int n_langs, const uint64_t n_offsets)
+{
+  return sizeof (struct dict_index_header)
+    + (n_langs * (DICT_MAX_LEN + 1) + 1) * sizeof (uint64_t)
+    + n_offsets * sizeof (uint64_t);
+}
+
+
+/*!
+ * Checks a line from the word list
+ * @param[out] langs bit l is set if the word can be used with language l
+ * @return the length of the word in characters, or 0 if it can't be used
+ */
+static int
+dict_check_line (const unsigned char *line, const size_t len,
+                 const struct lang_vars *st_langvars, const int n_langs,
+                 unsigned *langs)
+{
+  int n_chars = 0;
+  size_t pos = 0;
+  *langs = (1u << n_langs) - 1;
+  while (pos < len)
+  {
+    wchar_t wc;
+    const size_t n = utf8_decode (&wc, line + pos, len - pos);
+    if (n == 0 || wc == ' ' || wc == '.' || ++n_chars > DICT_MAX_LEN)
+      return 0;
+    pos += n;
+
+    int l;
+    for (l = 0; l < n_langs; l++)
+      if ((uint32_t) wc >= LANG_TABLE_SIZE
+          || st_langvars[l].index[wc] == NOT_IN_ALPHABET)
+        *langs &= ~(1u << l);
+    if (*langs == 0)
+      return 0;
+  }
+  return n_chars;
+}
+
+
+/*!
+ * Gets the next line, not including trailing white space
+ * @return the offset of the line after this one
+ */
+static size_t
+dict_next_line (const unsigned char *data, const size_t size, size_t pos,
+                size_t *line_len)
+{
+  const unsigned char *nl = memchr (data + pos, '\n', size - pos);
+  const size_t end = nl != NULL ? (size_t) (nl - data) : size;
+  size_t len = end - pos;
+  while (len > 0 && isspace (data[pos + len - 1]))
+    len--;
+  *line_len = len;
+  return nl != NULL ? end + 1 : size;
+}
+
+
+/*!
+ * Scans the whole word list and builds the index in memory
+ * @return the index, or NULL if there are no usable words
+ */
+static void *
+dict_build_index (const struct dict *dict, const struct lang_vars *st_langvars,
+                  const char *langs, const struct stat *st, size_t *idx_size)
+{
+  const int n_langs = dict->n_langs;
+  const size_t n_buckets = n_langs * (DICT_MAX_LEN + 1);
+  uint64_t *bucket_start = calloc (n_buckets + 1, sizeof *bucket_start);
+  fail (bucket_start == NULL, "Error allocating memory\n");
+
+  // First pass: count the words in each bucket
+  size_t pos = 0;
+  while (pos < dict->size)
+  {
+    size_t len;
+    const size_t next = dict_next_line (dict->data, dict->size, pos, &len);
+    unsigned word_langs;
+    const int n_chars = dict_check_line (dict->data + pos, len, st_langvars,
+                                         n_langs, &word_langs);
+    int l;
+    if (n_chars > 0)
+      for (l = 0; l < n_langs; l++)
+        if (word_langs & (1u << l))
+          bucket_start[l * (DICT_MAX_LEN + 1) + n_chars + 1]++;
+    pos = next;
+  }
+
+  size_t b;
+  for (b = 1; b <= n_buckets; b++)
+    bucket_start[b] += bucket_start[b - 1];
+  const uint64_t n_offsets = bucket_start[n_buckets];
+  if (n_offsets == 0)
+  {
+    free (bucket_start);
+    return NULL;
+  }
+
+  *idx_size = dict_index_size (n_langs, n_offsets);
+  unsigned char *idx = calloc (1, *idx_size);
+  fail (idx == NULL, "Error allocating memory\n");
+  struct dict_index_header *hdr = (struct dict_index_header *) idx;
+  memcpy (hdr->magic, DICT_MAGIC, sizeof hdr->magic);
+  hdr->dict_size = st->st_size;
+  hdr->dict_mtime = st->st_mtime;
+  snprintf (hdr->langs, sizeof hdr->langs, "%s", langs);
+  hdr->n_offsets = n_offsets;
+  uint64_t *idx_bucket_start = (uint64_t *) (hdr + 1);
+  uint64_t *offsets = idx_bucket_start + n_buckets + 1;
+  memcpy (idx_bucket_start, bucket_start, (n_buckets + 1) * sizeof *bucket_start);
+
+  // Second pass: store the offsets; bucket_start is used as the write position
+  pos = 0;
+  while (pos < dict->size)
+  {
+    size_t len;
+    const size_t next = dict_next_line (dict->data, dict->size, pos, &len);
+    unsigned word_langs;
+    const int n_chars = dict_check_line (dict->data + pos, len, st_langvars,
+                                         n_langs, &word_langs);
+    int l;
+    if (n_chars > 0)
+      for (l = 0; l < n_langs; l++)
+        if (word_langs & (1u << l))
+          offsets[bucket_start[l * (DICT_MAX_LEN + 1) + n_chars]++] = pos;
+    pos = next;
+  }
+
+  free (bucket_start);
+  return idx;
+}
+
+
+static int
+write_file (const char *path, const void *data, const size_t size)
+{
+  char tmp_path[PATH_MAX];
+  if ((size_t) snprintf (tmp_path, sizeof tmp_path, "%s.%d", path, (int) getpid ())
+      >= sizeof tmp_path)
+    return -1;
+
+  FILE *fp = fopen (tmp_path, "wb");
+  if (fp == NULL)
+    return -1;
+  const size_t written = fwrite (data, 1, size, fp);
+  if (fclose (fp) != 0 || written != size || rename (tmp_path, path) != 0)
+  {
+    remove (tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+
+static void
+dict_close (struct dict *dict)
+{
+  if (dict->idx_mapped)
+    munmap (dict->idx, dict->idx_size);
+  else
+    free (dict->idx);
+  if (dict->data != NULL)
+    munmap ((void *) dict->data, dict->size);
+  return;
+}
+
+
+/*!
+ * Checks that the bucket ranges and offsets of an index are usable with a
+ * word list of dict_size bytes, so a damaged index file is rebuilt rather
+ * than read outside the word list
+ * @return true if they are
+ */
+static bool
+dict_index_valid (const struct dict_index_header *hdr, const int n_langs,
+                  const uint64_t dict_size)
+{
+  const size_t n_buckets = n_langs * (DICT_MAX_LEN + 1);
+  const uint64_t *bucket_start = (const uint64_t *) (hdr + 1);
+  const uint64_t *offsets = bucket_start + n_buckets + 1;
+  // each line is indexed at most once per language; a bigger count could
+  // also have wrapped around in dict_index_size()
+  if (hdr->n_offsets > n_langs * dict_size
+      || bucket_start[0] != 0 || bucket_start[n_buckets] != hdr->n_offsets)
+    return false;
+  size_t b;
+  for (b = 1; b <= n_buckets; b++)
+    if (bucket_start[b] < bucket_start[b - 1])
+      return false;
+  uint64_t i;
+  for (i = 0; i < hdr->n_offsets; i++)
+    if (offsets[i] >= dict_size)
+      return false;
+  return true;
+}
+
+
+/*!
+ * Maps the word list into memory, along with its index (FILE.idx). If the
+ * index is missing, out of date or damaged, it's built and saved.
+ * @return 0 on success, -1 on error
+ */
+static int
+dict_open (struct dict *dict, const char *path, const struct lang_vars *st_langvars)
+{
+  memset (dict, 0, sizeof *dict);
+  dict->n_langs = count_langs (st_langvars);
+
+  char langs[64] = "";
+  int l;
+  for (l = 0; l < dict->n_langs; l++)
+  {
+    const size_t n = strlen (langs);
+    snprintf (langs + n, sizeof langs - n, "%s%s", l ? "," : "", st_langvars[l].lang);
+  }
+
+  const int fd = open (path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat (fd, &st) != 0)
+  {
+    fputs ("error opening dictionary: ", stderr);
+    perror (path);
+    if (fd >= 0)
+      close (fd);
+    return -1;
+  }
+  dict->size = st.st_size;
+  if (dict->size > 0)
+    dict->data = mmap (NULL, dict->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (dict->size == 0 || dict->data == MAP_FAILED)
+  {
+    dict->data = NULL;
+    fprintf (stderr, "Unable to map '%s'\n", path);
+    return -1;
+  }
+  madvise ((void *) dict->data, dict->size, MADV_RANDOM);
+
+  char idx_path[PATH_MAX];
+  if ((size_t) snprintf (idx_path, sizeof idx_path, "%s.idx", path) >= sizeof idx_path)
+  {
+    fputs ("index path truncated\n", stderr);
+    dict_close (dict);
+    return -1;
+  }
+
+  const int idx_fd = open (idx_path, O_RDONLY);
+  struct stat idx_st;
+  if (idx_fd >= 0 && fstat (idx_fd, &idx_st) == 0
+      && (size_t) idx_st.st_size >= sizeof (struct dict_index_header))
+  {
+    void *idx = mmap (NULL, idx_st.st_size, PROT_READ, MAP_PRIVATE, idx_fd, 0);
+    if (idx != MAP_FAILED)
+    {
+      const struct dict_index_header *hdr = idx;
+      if (memcmp (hdr->magic, DICT_MAGIC, sizeof hdr->magic) == 0
+          && hdr->dict_size == (uint64_t) st.st_size
+          && hdr->dict_mtime == (int64_t) st.st_mtime
+          && strncmp (hdr->langs, langs, sizeof hdr->langs) == 0
+          && dict_index_size (dict->n_langs, hdr->n_offsets) == (size_t) idx_st.st_size
+          && dict_index_valid (hdr, dict->n_langs, st.st_size))
+      {
+        dict->idx = idx;
+        dict->idx_size = idx_st.st_size;
+        dict->idx_mapped = true;
+      }
+      else
+        munmap (idx, idx_st.st_size);
+    }
+  }
+  if (idx_fd >= 0)
+    close (idx_fd);
+
+  if (dict->idx == NULL)
+  {
+    printf ("Indexing '%s'...\n", path);
+    dict->idx = dict_build_index (dict, st_langvars, langs, &st, &dict->idx_size);
+    if (dict->idx == NULL)
+    {
+      fprintf (stderr, "No usable words found in '%s'\n", path);
+      dict_close (dict);
+      return -1;
+    }
+    // Not being able to save the index only makes the next run slower
+    if (write_file (idx_path, dict->idx, dict->idx_size) != 0)
+      fprintf (stderr, "Unable to save index to '%s'\n", idx_path);
+  }
+
+  dict->bucket_start = (const uint64_t *) ((const struct dict_index_header *) dict->idx + 1);
+  dict->offsets = dict->bucket_start + dict->n_langs * (DICT_MAX_LEN + 1) + 1;
+  return 0;
+}
+
+
+/*!
+ * @return the number of words in the dictionary with a length of at most
+ * max_len
+ */
+static uint64_t
+dict_n_words (const struct dict *dict, const int lang_no, int max_len)
+{
+  if (max_len > DICT_MAX_LEN)
+    max_len = DICT_MAX_LEN;
+  const uint64_t *bucket = dict->bucket_start + lang_no * (DICT_MAX_LEN + 1);
+  return bucket[max_len + 1] - bucket[1];
+}
+
+
+/*!
+ * Picks n_words random words with a length of at most max_len
+ * @param[in] lang_no the position of the language in st_langvars
+ * @return the number of words picked, or -1 if there are none
+ */
+static int
+dict_get_words (const struct dict *dict, struct word_list *list, const int n_words,
+                const int lang_no, int max_len, struct rng *rng)
+{
+  if (max_len > DICT_MAX_LEN)
+    max_len = DICT_MAX_LEN;
+  const uint64_t *bucket = dict->bucket_start + lang_no * (DICT_MAX_LEN + 1);
+  const uint64_t first = bucket[1];
+  const uint64_t n_avail = dict_n_words (dict, lang_no, max_len);
+  if (n_avail == 0)
+    return -1;
+
+  // The offsets of the words already picked (plus one, so 0 means the slot
+  // is free), in an open addressing hash table
+  size_t n_slots = 64;
+  while (n_slots < (size_t) n_words * 2)
+    n_slots *= 2;
+  uint64_t *picked = calloc (n_slots, sizeof *picked);
+  fail (picked == NULL, "Error allocating memory\n");
+
+  int n = 0;
+  int tries = 0;
+  word_list_clear (list);
+  while (n < n_words && tries++ < n_words * 4)
+  {
+    const uint64_t offset = dict->offsets[first + rng_below (rng, n_avail)];
+
+    // don't use the same word twice, unless the list is very short
+    size_t slot = (offset * UINT64_C (0x9E3779B97F4A7C15)) & (n_slots - 1);
+    while (picked[slot] != 0 && picked[slot] != offset + 1)
+      slot = (slot + 1) & (n_slots - 1);
+    if (picked[slot] != 0 && n_avail > (uint64_t) n_words)
+      continue;
+    picked[slot] = offset + 1;
+
+    size_t len;
+    dict_next_line (dict->data, dict->size, offset, &len);
+    wchar_t word[DICT_MAX_LEN + 1];
+    size_t pos = 0;
+    int c = 0;
+    while (pos < len && c < DICT_MAX_LEN)
+    {
+      const size_t bytes = utf8_decode (&word[c], dict->data + offset + pos, len - pos);
+      if (bytes == 0)
+        break;
+      pos += bytes;
+      c++;
+    }
+    word_list_add (list, word, c);
+    n++;
+  }
+  free (picked);
+  return n;
+}
+
+
+/*!
+ * Converts a numeric command line argument
+ * @param[out] value set to the number if it's valid
+ * @param[in] what describes the argument in the error message
+ * @return 0 on success, -1 if arg isn't a number between min and max
+ */
+static int
+get_int_arg (int *value, const char *arg, const long min, const long max,
+             const char *what)
+{
+  char *endptr;
+  errno = 0;
+  const long n = strtol (arg, &endptr, 10);
+  if (errno != 0 || endptr == arg || *endptr != '\0' || n < min || n > max)
+  {
+    fprintf (stderr, "Invalid %s: '%s' (must be between %ld and %ld)\n", what,
+             arg, min, max);
+    return -1;
+  }
+  *value = n;
+  return 0;
+}
+
+
+/*!
+ * Shuffles the order in which the fetched words are tried, so each puzzle
+ * generated from the same word list gets a different selection and layout
+ * @param[out] order indexes into the fetched word list
+ * @param[in] n the number of elements in order
+ * @return void
+ */
+static void
+shuffle_order (int *order, const int n, struct rng *rng)
+{
+  // i is the number of elements still to shuffle
+  int i;
+  for (i = n; i > 1; i--)
+  {
+    const int j = rng_below (rng, i);
+    const int tmp = order[i - 1];
+    order[i - 1] = order[j];
+    order[j] = tmp;
+  }
+  return;
+}
+
+
+/*!
+ * The PLACE_DENSE part of place_words(): the words are placed all at once,
+ * then printed
+ * @return the number of words placed
+ */
+static int
+place_words_dense (FILE * restrict stream, struct grid *puzzle,
+                   const struct word_list *fetched_words, const int *order,
+                   struct word_list *words, const int max_words_target,
+                   const struct puzzle_opts *opts, struct rng *rng)
+{
+  const int max_len = get_max_len (puzzle);
+  const int n = fetched_words->n;
+  uint8_t *symbols = malloc ((size_t) n * max_len + 1);
+  const uint8_t **encoded = malloc ((n + 1) * sizeof *encoded);
+  size_t *lens = malloc ((n + 1) * sizeof *lens);
+  // for each encoded word, its index in fetched_words
+  int *from = malloc ((n + 1) * sizeof *from);
+  int *placed = calloc (n + 1, sizeof *placed);
+  fail (symbols == NULL || encoded == NULL || lens == NULL || from == NULL
+        || placed == NULL, "Error allocating memory\n");
+
+  int i, n_encoded = 0;
+  for (i = 0; i < n; i++)
+  {
+    const wchar_t *fetched = word_list_get (fetched_words, order[i]);
+    const size_t len = word_list_len (fetched_words, order[i]);
+    uint8_t *word = symbols + (size_t) n_encoded * max_len;
+    if (grid_encode (puzzle, fetched, len, word) != 0)
+    {
+      print_word (stream, "Skipping '", fetched, len, "'\n");
+      continue;
+    }
+    encoded[n_encoded] = word;
+    lens[n_encoded] = len;
+    from[n_encoded++] = order[i];
+  }
+
+  dir_op dir_op[N_DIRECTIONS];
+  create_dir_op (dir_op);
+  bool out_of_nodes;
+  const int n_placed = place_dense (dir_op, encoded, lens, n_encoded,
+                                    max_words_target, opts->dense_nodes,
+                                    puzzle, rng, placed, &out_of_nodes);
+  for (i = 0; i < n_placed; i++)
+  {
+    const int w = from[placed[i]];
+    word_list_add (words, word_list_get (fetched_words, w),
+                   word_list_len (fetched_words, w));
+    fprintf (stream, "%d.) ", i + 1);
+    print_word (stream, "", word_list_get (fetched_words, w),
+                word_list_len (fetched_words, w), "\n");
+  }
+  if (n_placed < max_words_target && out_of_nodes)
+    fprintf (stream, "Stopped after %d search nodes, with %d words placed\n",
+             opts->dense_nodes, n_placed);
+  else if (n_placed < max_words_target)
+    fprintf (stream, "Ran out of words after placing %d\n", n_placed);
+
+  free (symbols);
+  free (encoded);
+  free (lens);
+  free (from);
+  free (placed);
+  return n_placed;
+}
+
+
+/*!
+ * Places up to max_words_target words from the fetched word list into the
+ * puzzle
+ * @param[in] stream where to print the progress messages
+ * @param[in] order the order in which to try the fetched words
+ * @param[out] words the words that were placed
+ * @param[in] n_tot_err errors that have already happened (e.g. fetching)
+ * @return the number of words placed, or -1 if there were too many errors
+ */
+static int
+place_words (FILE * restrict stream, struct grid *puzzle,
+             const struct lang_vars *st_lang_ptr,
+             const struct word_list *fetched_words, const int *order,
+             struct word_list *words, const int max_words_target,
+             const struct puzzle_opts *opts, struct rng *rng, int n_tot_err)
+{
+  // this probably means the word server is having issues. If this number is exceeded,
+  // we'll quit completely
+  const int max_tot_err_allowed = max_words_target / 2 > 10 ? max_words_target / 2 : 10;
+  const int max_len = get_max_len (puzzle);
+
+  word_list_clear (words);
+  grid_set_alphabet (puzzle, st_lang_ptr);
+  if (opts->placement == PLACE_DENSE)
+    return place_words_dense (stream, puzzle, fetched_words, order, words,
+                              max_words_target, opts, rng);
+
+  dir_op dir_op[N_DIRECTIONS];
+  create_dir_op (dir_op);
+  // the word being placed, translated to the grid's symbols
+  uint8_t *word = malloc (max_len);
+  fail (word == NULL, "Error allocating memory\n");
+  int n_string = 0, f_string = 0;
+  int cur_dir = 0;
+  while ((n_string < max_words_target) && n_tot_err < max_tot_err_allowed)
+  {
+    if (f_string >= fetched_words->n)
+    {
+      fprintf (stream, "Ran out of words after placing %d\n", n_string);
+      break;
+    }
+
+    // words that are too long, or have spaces or dots, were dropped by
+    // word_list_filter() when they were fetched
+    const wchar_t *fetched = word_list_get (fetched_words, order[f_string]);
+    const size_t len = word_list_len (fetched_words, order[f_string]);
+    if (grid_encode (puzzle, fetched, len, word) != 0)
+    {
+      print_word (stream, "Skipping '", fetched, len, "'\n");
+      f_string++;
+      continue;
+    }
+
+    fprintf (stream, "%d.) ", n_string + 1);
+    print_word (stream, "", fetched, len, "\n");
+
+    // Try placing the word in all 8 directions, each direction at most
+    // MAX_TRIES_PER_DIRECTION. If successful, break from the loop and get
+    // the next word.
+    int d, r = -1;
+    if (opts->placement != PLACE_RANDOM)
+    {
+      r = opts->placement == PLACE_BITBOARD ?
+        place_bitboard (dir_op, word, len, puzzle, rng) :
+        place_exhaustive (dir_op, word, len, puzzle, rng);
+      if (!r)
+      {
+        word_list_add (words, fetched, len);
+        n_string++;
+        f_string++;
+      }
+    }
+    else for (d = 0; d < N_DIRECTIONS; d++)
+    {
+      r = place_random[cur_dir] (word, len, puzzle, rng);
+      cur_dir == N_DIRECTIONS - 1 ? cur_dir = 0 : cur_dir++;
+      if (!r)
+      {
+        word_list_add (words, fetched, len);
+        n_string++;
+        f_string++;
+        break;
+      }
+    }
+    if (r)
+    {
+      n_tot_err++;
+      print_word (stream, "Unable to find a place for '", fetched, len, "'\n");
+      f_string++;
+    }
+
+    if (n_tot_err >= max_tot_err_allowed)
+    {
+      fprintf (stderr, "Too many errors (%d); giving up\n", n_tot_err);
+      n_string = -1;
+      break;
+    }
+  }
+
+  free (word);
+  return n_string;
+}
+
+
+/*
+ * With --fetch-deadline, all the hosts are asked at the same time and the
+ * first list of words that comes back is used. The threads that lose the
+ * race (or are still waiting when the deadline passes) aren't waited for
+ * (until the program exits); the last one to finish frees the race.
+ */
+struct fetch_race
+{
+  pthread_mutex_t lock;
+  // signalled when a thread finishes
+  pthread_cond_t cond;
+  // the caller and the threads still running
+  int n_refs;
+  int n_running;
+  bool done;
+  // the winner's words
+  struct word_list words;
+  int n_err;
+  const char *lang;
+  int fetch_count;
+  int max_len;
+  int timeout_ms;
+};
+
+struct race_entry
+{
+  struct fetch_race *race;
+  const char *host;
+};
+
+// The race threads of all the races that are still running. curl can't be
+// cleaned up while they use it, so the program waits for them when it
+// exits; once their race is over, they stop after the attempt they're on,
+// which the deadline bounds.
+static pthread_mutex_t race_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t race_threads_cond = PTHREAD_COND_INITIALIZER;
+static int n_race_threads;
+
+
+static void
+fetch_race_release (struct fetch_race *race)
+{
+  const bool last = --race->n_refs == 0;
+  pthread_mutex_unlock (&race->lock);
+  if (last)
+  {
+    pthread_mutex_destroy (&race->lock);
+    pthread_cond_destroy (&race->cond);
+    word_list_free (&race->words);
+    free (race);
+  }
+  return;
+}
+
+
+static void *
+race_thread (void *arg)
+{
+  struct race_entry *entry = arg;
+  struct fetch_race *race = entry->race;
+  struct fetcher f;
+  fetcher_init (&f, race->timeout_ms);
+  struct word_list words = { 0 };
+  int r = -1, strikes = 0, n_err = 0;
+
+  // lang, fetch_count, max_len and timeout_ms don't change once the threads
+  // start
+  bool done = false;
+  while (r < 0 && strikes++ < 3 && !done)
+  {
+    r = get_words (&f, &words, race->fetch_count, race->lang, race->max_len,
+                   entry->host);
+    if (r < 0)
+      n_err++;
+    pthread_mutex_lock (&race->lock);
+    done = race->done;
+    pthread_mutex_unlock (&race->lock);
+  }
+  fetcher_close (&f);
+
+  pthread_mutex_lock (&race->lock);
+  if (r >= 0 && !race->done)
+  {
+    const struct word_list tmp = race->words;
+    race->words = words;
+    words = tmp;
+    race->done = true;
+  }
+  race->n_err += n_err;
+  race->n_running--;
+  pthread_cond_signal (&race->cond);
+  fetch_race_release (race);
+  word_list_free (&words);
+  free (entry);
+
+  pthread_mutex_lock (&race_threads_lock);
+  if (--n_race_threads == 0)
+    pthread_cond_broadcast (&race_threads_cond);
+  pthread_mutex_unlock (&race_threads_lock);
+  return NULL;
+}
+
+
+#ifdef HAVE_CURL
+/* Waits for the race threads that lost, before curl_global_cleanup() */
+static void
+wait_race_threads (void)
+{
+  pthread_mutex_lock (&race_threads_lock);
+  while (n_race_threads > 0)
+    pthread_cond_wait (&race_threads_cond, &race_threads_lock);
+  pthread_mutex_unlock (&race_threads_lock);
+  return;
+}
+#endif
+
+
+/*!
+ * Asks all the hosts for words at once
+ * @param[out] list the words of the first host that answered
+ * @param[in,out] n_tot_err incremented for each failed attempt
+ * @return the number of words, or -1 if no host answered within deadline_ms
+ */
+static int
+race_words (const struct fetch_opts *fetch, struct word_list *list,
+            const int fetch_count, const char *lang, const int max_len,
+            int *n_tot_err)
+{
+  struct fetch_race *race = calloc (1, sizeof *race);
+  fail (race == NULL, "Error allocating memory\n");
+  pthread_mutex_init (&race->lock, NULL);
+  pthread_cond_init (&race->cond, NULL);
+  race->n_refs = 1;
+  race->lang = lang;
+  race->fetch_count = fetch_count;
+  race->max_len = max_len;
+  race->timeout_ms = fetch->deadline_ms;
+
+  struct timespec deadline;
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += fetch->deadline_ms / 1000;
+  deadline.tv_nsec += (long) (fetch->deadline_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  pthread_mutex_lock (&race->lock);
+  const char **host_ptr;
+  for (host_ptr = fetch->hosts; *host_ptr != NULL; host_ptr++)
+  {
+    struct race_entry *entry = malloc (sizeof *entry);
+    fail (entry == NULL, "Error allocating memory\n");
+    entry->race = race;
+    entry->host = *host_ptr;
+    pthread_t thread;
+    pthread_mutex_lock (&race_threads_lock);
+    n_race_threads++;
+    pthread_mutex_unlock (&race_threads_lock);
+    const int err = pthread_create (&thread, &attr, race_thread, entry);
+    fail (err != 0, "Error creating thread: %s\n", strerror (err));
+    race->n_refs++;
+    race->n_running++;
+  }
+  pthread_attr_destroy (&attr);
+
+  int r, wait = 0;
+  while (!race->done && race->n_running > 0 && wait != ETIMEDOUT)
+    wait = pthread_cond_timedwait (&race->cond, &race->lock, &deadline);
+  *n_tot_err += race->n_err;
+  if (race->done)
+  {
+    const struct word_list tmp = *list;
+    *list = race->words;
+    race->words = tmp;
+    r = list->n;
+  }
+  else
+  {
+    if (race->n_running > 0)
+      fprintf (stderr, "No words within %d ms\n", fetch->deadline_ms);
+    r = -1;
+  }
+  // the threads that are still running see this and don't retry
+  race->done = true;
+  fetch_race_release (race);
+  return r;
+}
+
+
+/*!
+ * Tries each host until one of them returns a list of words, or with a
+ * deadline, asks all of them at once (see race_words())
+ * @param[in,out] f the connection to use, which is left open for the next
+ * fetch (without a deadline)
+ * @param[out] fetched_words the words that were fetched, except the ones
+ * word_list_filter() drops
+ * @param[in,out] n_tot_err incremented for each failed attempt
+ * @return the number of words kept, or -1 if all hosts failed
+ */
+static int
+fetch_words (struct fetcher *f, const struct fetch_opts *fetch,
+             struct word_list *fetched_words, const int fetch_count,
+             const char *lang, const int max_len, int *n_tot_err)
+{
+  const char **host_ptr = fetch->hosts;
+  int r = -1;
+  if (fetch->deadline_ms > 0)
+    r = race_words (fetch, fetched_words, fetch_count, lang, max_len,
+                    n_tot_err);
+  else while (*host_ptr != NULL && r < 0)
+  {
+    int strikes = 0;
+    do
+    {
+      r = get_words (f, fetched_words, fetch_count, lang, max_len, *host_ptr);
+      if (r < 0)
+        (*n_tot_err)++;
+    }
+    while (++strikes < 3 && r < 0);
+
+    if (r < 0)
+      fputs ("Failed to get words from server\n", stderr);
+
+    host_ptr++;
+  }
+  if (r >= 0)
+    r -= word_list_filter (fetched_words, max_len);
+  return r;
+}
+
+
+// The words of one language, fetched on a thread of their own
+struct fetch_job
+{
+  const struct fetch_opts *fetch;
+  const char *lang;
+  int fetch_count;
+  int max_len;
+  struct word_list words;
+  int n_tot_err;
+  int status;
+  pthread_t thread;
+};
+
+
+static void *
+fetch_job (void *arg)
+{
+  struct fetch_job *job = arg;
+  struct fetcher f;
+  fetcher_init (&f, 0);
+  job->status = fetch_words (&f, job->fetch, &job->words, job->fetch_count,
+                             job->lang, job->max_len, &job->n_tot_err);
+  fetcher_close (&f);
+  return NULL;
+}
+
+
+/*!
+ * Fetches the words of n languages at the same time
+ * @return 0 on success, -1 if the words of any language couldn't be fetched
+ */
+static int
+fetch_all_words (struct fetch_job *jobs, const int n)
+{
+  int i, r = 0;
+  for (i = 0; i < n; i++)
+  {
+    const int err = pthread_create (&jobs[i].thread, NULL, fetch_job, &jobs[i]);
+    fail (err != 0, "Error creating thread: %s\n", strerror (err));
+  }
+  for (i = 0; i < n; i++)
+  {
+    pthread_join (jobs[i].thread, NULL);
+    if (jobs[i].status < 0)
+      r = -1;
+  }
+  return r;
+}
+
+
+static struct lang_vars *
+get_lang_vars (struct lang_vars *st_langvars, const char *lang)
+{
+  struct lang_vars *st_lang_ptr = st_langvars;
+  while (st_lang_ptr->lang != NULL)
+  {
+    if (strcmp (lang, st_lang_ptr->lang) == 0)
+      return st_lang_ptr;
+    st_lang_ptr++;
+  }
+  return NULL;
+}
+
+
+// --lang=all (or '/?lang=all') makes puzzles for every language
+#define LANG_ALL "all"
+
+// Printed before the puzzles of each language when there's more than one
+static void
+print_lang_header (FILE * restrict stream, const char *lang)
+{
+  fprintf (stream, "\n ==] Language '%s' [==\n", lang);
+  return;
+}
+
+
+// How many batches each thread may finish before they're printed
+#define JOB_SLOTS_PER_THREAD 4
+
+// What every puzzle of a batch run is generated from
+struct job_params
+{
+  struct lang_vars *st_lang_ptr;
+  int lang_no;
+  // the fetched words or the words read from a file; NULL with a dictionary
+  const struct word_list *words;
+  const struct dict *dict;
+  const struct puzzle_opts *opts;
+  uint64_t seed;
+  int count;
+  bool want_log;
+  // added to the names of the log files with --lang=all, NULL otherwise
+  const char *log_lang;
+  // errors that happened while fetching the words
+  int n_tot_err;
+};
+
+// A finished batch, waiting to be printed
+struct job_slot
+{
+  char *out;
+  size_t out_len;
+  int status;
+  bool done;
+};
+
+struct job_set
+{
+  // one for each language; the batches of params[p] are numbered from
+  // p * batches_per_params
+  const struct job_params *params;
+  int n_params;
+  int batches_per_params;
+  struct job_queue *queues;
+  int n_threads;
+  int n_batches;
+
+  // guards everything below
+  pthread_mutex_t lock;
+  // signalled when a batch is finished or printed
+  pthread_cond_t cond;
+  // batch b is kept in slots[b % n_slots], so a thread has to wait until
+  // batch b - n_slots has been printed before starting batch b
+  struct job_slot *slots;
+  int n_slots;
+  int n_printed;
+  bool failed;
+};
+
+// What a thread reuses for each puzzle
+struct job_worker
+{
+  struct job_set *set;
+  int id;
+  pthread_t thread;
+  struct grid puzzle;
+  // words drawn from the dictionary
+  struct word_list fetched;
+  struct word_list words;
+  int *order;
+  struct out_buf out;
+};
+
+
+/*!
+ * Generates one puzzle and prints it to stream
+ * @return 0 on success, -1 if the puzzle couldn't be generated
+ */
+static int
+generate_puzzle (FILE * restrict stream, struct job_worker *worker,
+                 const struct job_params *params, const int puzzle_no)
+{
+  struct grid *puzzle = &worker->puzzle;
+  const int max_words_target = get_max_words_target (puzzle);
+  const int fetch_count = max_words_target * 1.2;
+  struct rng rng;
+  rng_seed_stream (&rng, params->seed, puzzle_no);
+
+  const struct word_list *fetched = params->words;
+  if (params->dict != NULL)
+  {
+    // A dictionary is cheap to draw from, so each puzzle gets new words
+    if (dict_get_words (params->dict, &worker->fetched, fetch_count,
+                        params->lang_no, get_max_len (puzzle), &rng) < 0)
+    {
+      fprintf (stderr, "No '%s' words in the dictionary\n",
+               params->st_lang_ptr->lang);
+      return -1;
+    }
+    fetched = &worker->fetched;
+  }
+
+  // The first puzzle uses the words in the order they were fetched
+  int i;
+  for (i = 0; i < fetched->n; i++)
+    worker->order[i] = i;
+  if (params->dict == NULL && puzzle_no > 1)
+    shuffle_order (worker->order, fetched->n, &rng);
+  order_words (worker->order, fetched->n, fetched, get_max_len (puzzle),
+               params->opts->order);
+
+  if (params->count > 1)
+    fprintf (stream, "\n ==] Puzzle %d of %d [==\n\n", puzzle_no, params->count);
+
+  init_puzzle (puzzle);
+  if (place_words (stream, puzzle, params->st_lang_ptr, fetched, worker->order,
+                   &worker->words, max_words_target, params->opts, &rng,
+                   params->n_tot_err) < 0)
+    return -1;
+
+  fill_puzzle (puzzle, &rng);
+  if (params->opts->unique
+      && make_unique (puzzle, &worker->words, &rng) < 0)
+    fputs ("Some words are in the puzzle more than once\n", stream);
+  print_puzzle (stream, &worker->out, puzzle, &worker->words);
+
+  // write the seed, answer key, and puzzle to a file
+  if (params->want_log)
+    return write_log (&worker->words, puzzle, params->seed, params->log_lang,
+                      params->count > 1 ? puzzle_no : 0, &worker->out);
+  return 0;
+}
+
+
+static void *
+job_worker (void *arg)
+{
+  struct job_worker *worker = arg;
+  struct job_set *set = worker->set;
+  int batch;
+  while ((batch = job_queue_take (set->queues, set->n_threads, worker->id)) >= 0)
+  {
+    pthread_mutex_lock (&set->lock);
+    while (!set->failed && batch >= set->n_printed + set->n_slots)
+      pthread_cond_wait (&set->cond, &set->lock);
+    const bool failed = set->failed;
+    pthread_mutex_unlock (&set->lock);
+    if (failed)
+      break;
+
+    struct job_slot slot = { NULL, 0, 0, true };
+    FILE *fp = open_memstream (&slot.out, &slot.out_len);
+    fail (fp == NULL, "Error allocating memory\n");
+    const struct job_params *params =
+      &set->params[batch / set->batches_per_params];
+    const int count = params->count;
+    int puzzle_no = batch % set->batches_per_params * JOB_BATCH_SIZE + 1;
+    const int last = count - puzzle_no < JOB_BATCH_SIZE ?
+      count : puzzle_no + JOB_BATCH_SIZE - 1;
+    for (; puzzle_no <= last && slot.status == 0; puzzle_no++)
+      slot.status = generate_puzzle (fp, worker, params, puzzle_no);
+    fail (fclose (fp) != 0, "Error allocating memory\n");
+
+    pthread_mutex_lock (&set->lock);
+    set->slots[batch % set->n_slots] = slot;
+    pthread_cond_broadcast (&set->cond);
+    pthread_mutex_unlock (&set->lock);
+  }
+  return NULL;
+}
+
+
+/*!
+ * Generates the puzzles of n_params sets of parameters (one for each
+ * language with --lang=all) on n_threads threads and prints them to stdout
+ * in order. Every set has the same count.
+ * @return 0 on success, -1 if a puzzle couldn't be generated
+ */
+static int
+run_jobs (const struct job_params *params, const int n_params,
+          const int n_threads)
+{
+  struct job_set set;
+  set.params = params;
+  set.n_params = n_params;
+  set.batches_per_params = (params->count - 1) / JOB_BATCH_SIZE + 1;
+  set.n_threads = n_threads;
+  set.n_batches = n_params * set.batches_per_params;
+  set.n_slots = n_threads * JOB_SLOTS_PER_THREAD;
+  set.n_printed = 0;
+  set.failed = false;
+  set.slots = calloc (set.n_slots, sizeof *set.slots);
+  set.queues = malloc (n_threads * sizeof *set.queues);
+  struct job_worker *workers = calloc (n_threads, sizeof *workers);
+  fail (set.slots == NULL || set.queues == NULL || workers == NULL,
+        "Error allocating memory\n");
+  job_queues_init (set.queues, n_threads, set.n_batches);
+  pthread_mutex_init (&set.lock, NULL);
+  pthread_cond_init (&set.cond, NULL);
+
+  const struct puzzle_opts *opts = params->opts;
+  int t, p;
+  for (t = 0; t < n_threads; t++)
+  {
+    struct job_worker *worker = &workers[t];
+    worker->set = &set;
+    worker->id = t;
+    fail (grid_alloc (&worker->puzzle, opts->rows, opts->cols) != 0
+          || (opts->placement == PLACE_BITBOARD
+              && grid_alloc_bitboard (&worker->puzzle) != 0),
+          "Error allocating memory\n");
+    int order_size = get_max_words_target (&worker->puzzle) * 2;
+    for (p = 0; p < n_params; p++)
+      if (params[p].words != NULL && params[p].words->n > order_size)
+        order_size = params[p].words->n;
+    worker->order = malloc (order_size * sizeof *worker->order);
+    fail (worker->order == NULL, "Error allocating memory\n");
+    const int r = pthread_create (&worker->thread, NULL, job_worker, worker);
+    fail (r != 0, "Error creating thread: %s\n", strerror (r));
+  }
+
+  int status = 0;
+  int batch;
+  for (batch = 0; batch < set.n_batches && status == 0; batch++)
+  {
+    pthread_mutex_lock (&set.lock);
+    struct job_slot *slot_ptr = &set.slots[batch % set.n_slots];
+    while (!slot_ptr->done)
+      pthread_cond_wait (&set.cond, &set.lock);
+    const struct job_slot slot = *slot_ptr;
+    slot_ptr->done = false;
+    set.n_printed++;
+    if (slot.status != 0)
+      set.failed = true;
+    pthread_cond_broadcast (&set.cond);
+    pthread_mutex_unlock (&set.lock);
+
+    if (n_params > 1 && batch % set.batches_per_params == 0)
+      print_lang_header (stdout, params[batch / set.batches_per_params].st_lang_ptr->lang);
+    fwrite (slot.out, 1, slot.out_len, stdout);
+    free (slot.out);
+    status = slot.status;
+  }
+
+  for (t = 0; t < n_threads; t++)
+  {
+    pthread_join (workers[t].thread, NULL);
+    grid_free (&workers[t].puzzle);
+    word_list_free (&workers[t].fetched);
+    word_list_free (&workers[t].words);
+    free (workers[t].order);
+    out_buf_free (&workers[t].out);
+  }
+  // batches finished after one of them failed
+  for (t = 0; t < set.n_slots; t++)
+    if (set.slots[t].done)
+      free (set.slots[t].out);
+
+  pthread_cond_destroy (&set.cond);
+  pthread_mutex_destroy (&set.lock);
+  job_queues_destroy (set.queues, n_threads);
+  free (set.queues);
+  free (set.slots);
+  free (workers);
+  return status;
+}
+
+
+/*!
+ * Reads a puzzle for --solve: the rows of the grid (white space between the
+ * letters is ignored), an empty line, then the words, separated by white
+ * space. Everything is upper-cased.
+ * @param[out] puzzle allocated to the size of the grid
+ * @return 0 on success, -1 on error
+ */
+static int
+read_solve_file (const char *path, struct grid *puzzle, struct word_list *words)
+{
+  FILE *fp = fopen (path, "r");
+  if (fp == NULL)
+  {
+    fputs ("error opening puzzle file: ", stderr);
+    perror (path);
+    return -1;
+  }
+
+  struct word_list rows = { 0 };
+  // grown with the longest line, but never NULL
+  size_t wline_cap = BUFSIZ;
+  wchar_t *wline = malloc (wline_cap * sizeof *wline);
+  fail (wline == NULL, "Error allocating memory\n");
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  int line_no = 0;
+  bool in_words = false;
+  int r = 0;
+  while (r == 0 && (len = getline (&line, &line_cap, fp)) >= 0)
+  {
+    line_no++;
+    if ((size_t) len + 1 > wline_cap)
+    {
+      wline_cap = len + 1;
+      wchar_t *grown = realloc (wline, wline_cap * sizeof *wline);
+      fail (grown == NULL, "Error allocating memory\n");
+      wline = grown;
+    }
+
+    // decode, dropping the white space between letters
+    size_t n = 0;
+    ssize_t pos = 0;
+    while (pos < len)
+    {
+      wchar_t wc;
+      const size_t bytes = utf8_decode (&wc, (const unsigned char *) line + pos, len - pos);
+      if (bytes == 0)
+      {
+        fprintf (stderr, "%s:%d: invalid UTF-8\n", path, line_no);
+        r = -1;
+        break;
+      }
+      pos += bytes;
+      if (in_words || !iswspace (wc))
+        wline[n++] = upcase (wc);
+    }
+    if (r != 0)
+      break;
+
+    if (!in_words)
+    {
+      if (n == 0 && rows.n > 0)
+        in_words = true;
+      else if (n > 0)
+      {
+        if (rows.n > 0 && n != word_list_len (&rows, 0))
+        {
+          fprintf (stderr, "%s:%d: all the rows must have the same length\n",
+                   path, line_no);
+          r = -1;
+        }
+        word_list_add (&rows, wline, n);
+      }
+      continue;
+    }
+
+    size_t start = 0, i;
+    for (i = 0; i <= n; i++)
+      if (i == n || iswspace (wline[i]))
+      {
+        if (i > start)
+          word_list_add (words, wline + start, i - start);
+        start = i + 1;
+      }
+  }
+  free (line);
+  free (wline);
+  fclose (fp);
+
+  if (r == 0 && (rows.n == 0 || words->n == 0))
+  {
+    fprintf (stderr, "%s: expected the rows of the puzzle, an empty line and "
+             "the words\n", path);
+    r = -1;
+  }
+  if (r == 0)
+  {
+    // the grid's symbols are just the letters it has
+    fail (grid_alloc (puzzle, rows.n, word_list_len (&rows, 0)) != 0,
+          "Error allocating memory\n");
+    int i;
+    for (i = 0; i < rows.n && r == 0; i++)
+      if (grid_encode (puzzle, word_list_get (&rows, i), puzzle->cols,
+                       &CELL (puzzle, i, 0)) != 0)
+      {
+        fprintf (stderr, "%s: more than %d different letters\n", path, MAX_SYMBOLS);
+        r = -1;
+      }
+    if (r != 0)
+      grid_free (puzzle);
+  }
+  word_list_free (&rows);
+  return r;
+}
+
 
-  /* "format" is the format of the HTTP request we send to the web
-     server. */
+static int
+cmp_match (const void *a, const void *b)
+{
+  const struct match *x = a, *y = b;
+  if (x->word != y->word)
+    return x->word - y->word;
+  if (x->row != y->row)
+    return x->row - y->row;
+  if (x->col != y->col)
+    return x->col - y->col;
+  return x->dir - y->dir;
+}
 
-  const char *format = "\
-GET /word?number=%d&lang=%s HTTP/1.1\r\n\
-Host: %s\r\n\
-User-Agent: github.com/theimpossibleastronaut/aawordsearch (v%s)\r\n\
-\r\n";
 
-  /* "msg" is the request message that we will send to the
-     server. */
+/*!
+ * Prints every place each word of the puzzle in path is found, then an
+ * answer key that only shows the letters of the words found
+ * @return 0 if every word was found, 1 if some weren't, -1 on error
+ */
+static int
+solve (const char *path)
+{
+  static const char *const dir_names[N_DIRECTIONS] = {
+    "right", "left", "down", "up", "down-right", "down-left", "up-right", "up-left"
+  };
 
-  char msg[BUFSIZ];
-  int status =
-    snprintf (msg, BUFSIZ, format, fetch_count, lang, host_ptr, VERSION);
-  if (status >= BUFSIZ)
+  struct grid puzzle;
+  struct word_list words = { 0 };
+  if (read_solve_file (path, &puzzle, &words) != 0)
   {
-    fputs ("snprintf failed.", stderr);
+    word_list_free (&words);
     return -1;
   }
 
-  /* Send the request. */
-  status = send (s, msg, strlen (msg), 0);
-
-  /* Check it succeeded. The FreeBSD manual page doesn't mention
-     whether "send" sets errno, but
-     "http://pubs.opengroup.org/onlinepubs/009695399/functions/send.html"
-     claims it does. */
-
-  fail (status == -1, "send failed: %s\n", strerror (errno));
-
-  /* Our receiving buffer. */
-  char srv_str[BUFSIZ + 10];
-  *srv_str = '\0';
-  char buf[BUFSIZ + 10];
-  *buf = '\0';
-  int bytes;
-  int bytes_total = 0;
+  dir_op dir_op[N_DIRECTIONS];
+  create_dir_op (dir_op);
+  struct matcher m;
+  matcher_build (&m, &words);
+  struct match *matches = NULL;
+  int cap = 0;
+  const int n = find_words (&m, &words, &puzzle, puzzle.cells, dir_op, &matches, &cap);
+  qsort (matches, n, sizeof *matches, cmp_match);
+
+  // the answer key; puzzle.filled is free, since nothing was placed
+  memset (puzzle.filled, EMPTY_CELL, (size_t) puzzle.rows * puzzle.stride);
+  int i;
 
-  /* Loop until there is no data left to be read
-     (see the recv man page for return codes) */
-  while ((bytes = recv (s, srv_str, BUFSIZ, 0)) > 0)
+  struct out_buf buf = { 0 };
+  char str[64];
+  int r = 0;
+  int k = 0;
+  for (i = 0; i < words.n; i++)
   {
-    int max_len = BUFSIZ - bytes_total;
-    // concatenate the string each iteration of the loop
-    status = snprintf (buf + bytes_total, max_len, "%s", srv_str);
-    if (status >= max_len)
+    // a word that's in the list twice is only shown once
+    if (m.word[m.word_state[i]] != i)
+      continue;
+    if (k == n || matches[k].word != i)
     {
-      fputs ("snprintf failed.", stderr);
-      return -1;
+      out_buf_add_wcs (&buf, word_list_get (&words, i), word_list_len (&words, i));
+      out_buf_add (&buf, ": not found\n", 12);
+      r = 1;
+      continue;
+    }
+    for (; k < n && matches[k].word == i; k++)
+    {
+      const struct match *match = &matches[k];
+      out_buf_add_wcs (&buf, word_list_get (&words, i), word_list_len (&words, i));
+      const int str_len = snprintf (str, sizeof str, ": row %d, column %d, %s\n",
+                                    match->row + 1, match->col + 1,
+                                    dir_names[match->dir]);
+      out_buf_add (&buf, str, str_len);
+      const int len = word_list_len (&words, i);
+      int l;
+      for (l = 0; l < len; l++)
+      {
+        const size_t cell = (size_t) (match->row + l * dir_op[match->dir].row) * puzzle.stride
+          + match->col + l * dir_op[match->dir].col;
+        puzzle.filled[cell] = puzzle.cells[cell];
+      }
     }
-    bytes_total += bytes;
   }
 
-  if (close (s) != 0)
-  {
-    fputs ("Error closing socket\n", stderr);
-    return -1;
-  }
+  static const char key_header[] = "\n ==] Answer key [==\n";
+  out_buf_add (&buf, key_header, sizeof key_header - 1);
+  render_grid (&buf, &puzzle, puzzle.filled);
+  fwrite (buf.data, 1, buf.len, stdout);
+
+  out_buf_free (&buf);
+  free (matches);
+  matcher_free (&m);
+  word_list_free (&words);
+  grid_free (&puzzle);
+  return r;
+}
 
-  fail (bytes == -1, "%s\n", strerror (errno));
 
-  if (bytes_total == 0)
-    return -1;
+// After this many puzzles, a server worker fetches a new list of words for
+// that language
+const int SERVE_POOL_MAX_USES = 20;
 
-  buf_ptr = buf;
+// Where the server gets its words from when they aren't fetched from HOST
+struct word_source
+{
+  // words read with --input-file
+  const struct word_list *file_words;
+  // --dict; with --fetch-deadline, it's only used when no host answers in
+  // time
+  const struct dict *dict;
+  const struct fetch_opts *fetch;
+};
 
-#endif
 
-  // convert buf from char* to wchar_t*
-  size_t buf_size = strlen(buf_ptr) + 1;
-  wchar_t wbuf[buf_size];
-  mbstowcs (wbuf, buf_ptr, buf_size);
+// Whether the words of a source are fetched from the hosts (when they
+// aren't read from a file)
+static inline bool
+source_fetches (const struct word_source *source)
+{
+  return source->dict == NULL || source->fetch->deadline_ms > 0;
+}
 
-  const wchar_t open_bracket[] = L"[\"";
-  const wchar_t closed_bracket[] = L"\"]";
-  const char *str_not_found = "Expected '%s' not found in string\n";
-  wchar_t *buf_start = wcsstr (wbuf, open_bracket);
+// Words kept by a server worker between requests
+struct word_pool
+{
+  struct word_list words;
+  int *order;
+  int n_uses;
+};
 
-  if (buf_start != NULL)
-    buf_start++;
-  else
-  {
-    fprintf (stderr, str_not_found, open_bracket);
-    return -1;
-  }
+// How many word lists of each language the prefetch thread keeps ready
+#define PREFETCH_DEPTH 2
+// How long the prefetch thread waits after a failed fetch
+const int PREFETCH_RETRY_SECONDS = 10;
 
-  wchar_t *buf_end = wcsstr (buf_start, closed_bracket);
-  if (buf_end != NULL)
-    *buf_end = '\0';            // replaces the ']' so the string should end with '"'
-  else
-  {
-    fprintf (stderr, str_not_found, closed_bracket);
-    return -1;
-  }
+/*
+ * Word lists fetched ahead of time by a thread of their own, one ring buffer
+ * of PREFETCH_DEPTH lists for each language. When a server worker needs new
+ * words, it takes a list from the ring, so it doesn't wait for the network
+ * unless the ring is empty. The thread then fetches another one.
+ */
+struct prefetch_ring
+{
+  struct word_list lists[PREFETCH_DEPTH];
+  // the oldest list, and the number of lists that are ready
+  int head;
+  int n_ready;
+};
+
+struct prefetch
+{
+  const struct fetch_opts *fetch;
+  const struct lang_vars *st_langvars;
+  int n_langs;
+  int fetch_count;
+  int max_len;
+  struct prefetch_ring *rings;
+  // guards the rings
+  pthread_mutex_t lock;
+  // signalled when a list is taken
+  pthread_cond_t cond;
+  pthread_t thread;
+};
 
-  wchar_t *wptr;
-  const wchar_t delimiter[] = L"\",\"";
-  wchar_t *token = wcstok (buf_start, delimiter, &wptr);
-  int n_word = 0;
 
-  while (token != NULL)
+static void *
+prefetch_thread (void *arg)
+{
+  struct prefetch *pf = arg;
+  struct fetcher f;
+  fetcher_init (&f, 0);
+  struct word_list fetched = { 0 };
+  int l = 0;
+
+  pthread_mutex_lock (&pf->lock);
+  while (1)
   {
-    // printf("[%s]\n", token);
-    wcscpy (str[n_word], token);
-    token = wcstok (NULL, delimiter, &wptr);
-    n_word++;
-  }
+    // the next language (round robin) whose ring isn't full
+    int i;
+    for (i = 0; i < pf->n_langs && pf->rings[l].n_ready == PREFETCH_DEPTH; i++)
+      l = (l + 1) % pf->n_langs;
+    if (i == pf->n_langs)
+    {
+      pthread_cond_wait (&pf->cond, &pf->lock);
+      continue;
+    }
+    pthread_mutex_unlock (&pf->lock);
 
-  return 0;
+    int n_err = 0;
+    const int r = fetch_words (&f, pf->fetch, &fetched, pf->fetch_count,
+                               pf->st_langvars[l].lang, pf->max_len, &n_err);
+
+    pthread_mutex_lock (&pf->lock);
+    if (r > 0)
+    {
+      // swap, so the ring's old list is reused for the next fetch
+      struct prefetch_ring *ring = &pf->rings[l];
+      struct word_list *slot =
+        &ring->lists[(ring->head + ring->n_ready) % PREFETCH_DEPTH];
+      const struct word_list tmp = *slot;
+      *slot = fetched;
+      fetched = tmp;
+      ring->n_ready++;
+      l = (l + 1) % pf->n_langs;
+    }
+    else
+    {
+      struct timespec until;
+      clock_gettime (CLOCK_REALTIME, &until);
+      until.tv_sec += PREFETCH_RETRY_SECONDS;
+      pthread_cond_timedwait (&pf->cond, &pf->lock, &until);
+    }
+  }
+  return NULL;
 }
 
 
-static inline int
-placer (dir_op * dir_op, const wchar_t *str, wchar_t puzzle[][GRID_SIZE])
+/*!
+ * Starts the prefetch thread, which fills the rings of all the languages
+ * @return void
+ */
+static void
+prefetch_start (struct prefetch *pf, const struct fetch_opts *fetch,
+                const struct lang_vars *st_langvars, const int fetch_count,
+                const int max_len)
 {
-  int row = dir_op->begin_row;
-  int col = dir_op->begin_col;
-  wchar_t *ptr = (wchar_t *) str;
-  while (*ptr)
-  {
-    const wchar_t u = towupper (*ptr);
-    if (!(u == puzzle[row][col] || puzzle[row][col] == fill_char))
-      return -1;
-    ptr++;
-    row += dir_op->row;
-    col += dir_op->col;
-  }
+  pf->fetch = fetch;
+  pf->st_langvars = st_langvars;
+  pf->n_langs = count_langs (st_langvars);
+  pf->fetch_count = fetch_count;
+  pf->max_len = max_len;
+  pf->rings = calloc (pf->n_langs, sizeof *pf->rings);
+  fail (pf->rings == NULL, "Error allocating memory\n");
+  pthread_mutex_init (&pf->lock, NULL);
+  pthread_cond_init (&pf->cond, NULL);
+  const int err = pthread_create (&pf->thread, NULL, prefetch_thread, pf);
+  fail (err != 0, "Error creating thread: %s\n", strerror (err));
+  return;
+}
+
 
-  row = dir_op->begin_row;
-  col = dir_op->begin_col;
-  ptr = (wchar_t *) str;
-  while (*ptr != '\0')
+/*!
+ * Takes a list of words from the ring of language lang_no, if one is ready.
+ * The list is swapped with words, whose memory goes back to the ring.
+ * @return true if words now has the prefetched list
+ */
+static bool
+prefetch_take (struct prefetch *pf, const int lang_no, struct word_list *words)
+{
+  pthread_mutex_lock (&pf->lock);
+  struct prefetch_ring *ring = &pf->rings[lang_no];
+  const bool ready = ring->n_ready > 0;
+  if (ready)
   {
-    const wchar_t u = towupper (*ptr);
-    puzzle[row][col] = u;
-    ptr++;
-    col += dir_op->col;
-    row += dir_op->row;
+    struct word_list *slot = &ring->lists[ring->head];
+    const struct word_list tmp = *slot;
+    *slot = *words;
+    *words = tmp;
+    word_list_clear (slot);
+    ring->head = (ring->head + 1) % PREFETCH_DEPTH;
+    ring->n_ready--;
+    pthread_cond_signal (&pf->cond);
   }
-  return 0;
+  pthread_mutex_unlock (&pf->lock);
+  return ready;
 }
 
+// What a server worker reuses for each request
+struct worker_state
+{
+  struct grid puzzle;
+  // one for each language
+  struct word_pool *pools;
+  struct word_list words;
+  struct out_buf out;
+  struct rng rng;
+  // kept open between requests
+  struct fetcher fetcher;
+  // NULL unless the words are fetched from HOST
+  struct prefetch *prefetch;
+};
 
-void
-print_answer_key (FILE * restrict stream, wchar_t puzzle[][GRID_SIZE])
+
+static void
+write_html_escaped (FILE * restrict stream, const char *str, size_t len)
 {
-  int i, j;
-  fputs (" ==] Answer key [==\n", stream);
-  for (i = 0; i < GRID_SIZE; i++)
+  size_t i;
+  for (i = 0; i < len; i++)
   {
-    for (j = 0; j < GRID_SIZE; j++)
+    switch (str[i])
     {
-      fprintf (stream, "%lc ", puzzle[i][j]);
+    case '<':
+      fputs ("&lt;", stream);
+      break;
+    case '>':
+      fputs ("&gt;", stream);
+      break;
+    case '&':
+      fputs ("&amp;", stream);
+      break;
+    default:
+      fputc (str[i], stream);
     }
-    fputs ("\n", stream);
   }
-  fputs ("\n\n\n", stream);
   return;
 }
 
 
-void
-print_puzzle (FILE * restrict stream, wchar_t puzzle[][GRID_SIZE], struct lang_vars *st_lang_ptr)
+static void
+send_response (FILE * restrict stream, const char *status, const char *body,
+               size_t body_len)
 {
-  int i, j;
-  for (i = 0; i < GRID_SIZE; i++)
-  {
-    for (j = 0; j < GRID_SIZE; j++)
-    {
-      if (puzzle[i][j] == fill_char)
-        fprintf (stream, "%lc ",
-                 st_lang_ptr->alphabet[rand () % st_lang_ptr->length]);
-      else
-        fprintf (stream, "%lc ", puzzle[i][j]);
-    }
-    fputs ("\n", stream);
-  }
-  fputs ("\n", stream);
+  fprintf (stream, "HTTP/1.0 %s\r\n\
+Content-Type: text/html;charset=utf-8\r\n\
+Content-Length: %zu\r\n\
+Connection: close\r\n\
+\r\n", status, body_len);
+  fwrite (body, 1, body_len, stream);
   return;
 }
 
 
-static void
-print_words (FILE * restrict stream, wchar_t words[][BUFSIZ], const int n_string)
+/*!
+ * Generates a puzzle of one language for the server and prints it to fp
+ * @return 0 on success, -1 if the puzzle couldn't be generated
+ */
+static int
+build_puzzle (FILE * restrict fp, struct worker_state *worker,
+              struct lang_vars *st_lang_ptr, const int lang_no,
+              const struct word_source *source, const struct puzzle_opts *opts)
 {
-  int i = 0;
-  while (i < n_string)
-  {
-    if (*words[i] != '\0')
-      fprintf (stream, "%*ls", MAX_LEN + 1, words[i]);
-    i++;
+  struct grid *puzzle = &worker->puzzle;
+  struct word_pool *pool = &worker->pools[lang_no];
+  struct word_list *words = &worker->words;
+  const int max_words_target = get_max_words_target (puzzle);
+  const int fetch_count = max_words_target * 1.2;
+  int n_tot_err = 0;
+  int i;
 
-    // start a new row after every 3 words
-    if (i % 3 == 0)
-      fputs ("\n", stream);
+  // Words read from --input-file are loaded once, when the worker starts.
+  // Picking words from a dictionary is cheap enough to do for every puzzle.
+  // Words from the hosts are usually fetched ahead of time by the prefetch
+  // thread; they're only fetched here if it has none ready. With
+  // --fetch-deadline, the dictionary is used if no host answers in time.
+  const struct word_list *fetched = &pool->words;
+  if (source->file_words != NULL)
+  {
+    fetched = source->file_words;
+    shuffle_order (pool->order, fetched->n, &worker->rng);
   }
-  fputs ("\n", stream);
-  return;
+  else if (!source_fetches (source) || pool->words.n == 0
+           || pool->n_uses >= SERVE_POOL_MAX_USES)
+  {
+    int r = -1;
+    if (source_fetches (source))
+      r = prefetch_take (worker->prefetch, lang_no, &pool->words) ?
+        pool->words.n :
+        fetch_words (&worker->fetcher, source->fetch, &pool->words,
+                     fetch_count, st_lang_ptr->lang, get_max_len (puzzle),
+                     &n_tot_err);
+    if (r < 0 && source->dict != NULL)
+      r = dict_get_words (source->dict, &pool->words, fetch_count, lang_no,
+                          get_max_len (puzzle), &worker->rng);
+    if (r < 0)
+      return -1;
+    pool->n_uses = 0;
+    for (i = 0; i < pool->words.n; i++)
+      pool->order[i] = i;
+  }
+  else
+    shuffle_order (pool->order, pool->words.n, &worker->rng);
+  pool->n_uses++;
+  order_words (pool->order, fetched->n, fetched, get_max_len (puzzle),
+               opts->order);
+
+  init_puzzle (puzzle);
+  if (place_words (fp, puzzle, st_lang_ptr, fetched, pool->order, words,
+                   max_words_target, opts, &worker->rng, n_tot_err) < 0)
+    return -1;
+  fill_puzzle (puzzle, &worker->rng);
+  if (opts->unique
+      && make_unique (puzzle, words, &worker->rng) < 0)
+    fputs ("Some words are in the puzzle more than once\n", fp);
+  print_puzzle (fp, &worker->out, puzzle, words);
+  return 0;
 }
 
 
-dir_op *
-create_dir_op ()
+/*!
+ * Generates the same page website/cgi-bin/aawordsearch.cgi builds, with a
+ * puzzle for each of the n_langs languages from st_langvars[first_lang]
+ * on ('/?lang=all' asks for all of them)
+ * @param[out] page set to a malloc'ed string, or NULL if the puzzle
+ * couldn't be generated
+ * @return the length of the page
+ */
+static size_t
+build_page (char **page, struct worker_state *worker,
+            struct lang_vars *st_langvars, const int first_lang,
+            const int n_langs, const struct word_source *source,
+            const struct puzzle_opts *opts)
 {
-  static dir_op dir_ops[] = {
-    {0, 0, HORIZONTAL_NOOP, HORIZONTAL_INC},
-    {0, 0, HORIZONTAL_BACKWARD_NOOP, HORIZONTAL_BACKWARD_DEC},
-    {0, 0, VERTICAL_INC, VERTICAL_NOOP},
-    {0, 0, VERTICAL_UP_DEC, VERTICAL_UP_NOOP},
-    {0, 0, DIAGONAL_DOWN_RIGHT_INC, DIAGONAL_DOWN_RIGHT_INC},
-    {0, 0, DIAGONAL_DOWN_LEFT_INC, DIAGONAL_DOWN_LEFT_DEC},
-    {0, 0, DIAGONAL_UP_RIGHT_DEC, DIAGONAL_UP_RIGHT_INC},
-    {0, 0, DIAGONAL_UP_LEFT_DEC, DIAGONAL_UP_LEFT_DEC}
-  };
-  return dir_ops;
+  *page = NULL;
+
+  char *pre;
+  size_t pre_len;
+  FILE *fp = open_memstream (&pre, &pre_len);
+  if (fp == NULL)
+    return 0;
+
+  fputs (PROGRAM_NAME " " VERSION "\n\n", fp);
+  int l, r = 0;
+  for (l = first_lang; l < first_lang + n_langs && r == 0; l++)
+  {
+    if (n_langs > 1)
+      print_lang_header (fp, st_langvars[l].lang);
+    r = build_puzzle (fp, worker, &st_langvars[l], l, source, opts);
+  }
+  if (fclose (fp) != 0 || r != 0)
+  {
+    free (pre);
+    return 0;
+  }
+
+  size_t page_len;
+  fp = open_memstream (page, &page_len);
+  if (fp == NULL)
+  {
+    free (pre);
+    return 0;
+  }
+  fputs ("<!DOCTYPE html>\
+<html lang=en>\
+<head>\
+<title>aawordsearch | Generated word search puzzle</title>\
+</head>\
+<body>\
+<pre>", fp);
+  write_html_escaped (fp, pre, pre_len);
+  fputs ("</pre>\
+<p>Generated by <a href=\"https://github.com/theimpossibleastronaut/aawordsearch\">aawordsearch</a></p>\
+<p><a href=\"/\">Home</a></p>\
+</body>\
+</html>", fp);
+  free (pre);
+  if (fclose (fp) != 0)
+  {
+    free (*page);
+    *page = NULL;
+    return 0;
+  }
+  return page_len;
 }
 
 
-/* For long options that have no equivalent short option, use a
-   non-character as a pseudo short option, starting with CHAR_MAX + 1.  */
-enum
+/*!
+ * Gets the language from the request target. Both '/?lang=xx' and the
+ * '/?xx' form used by the CGI script are accepted.
+ * @return the language, or NULL if the target isn't a puzzle request
+ */
+static const char *
+parse_target (char *target)
 {
-  INPUT_FILE = CHAR_MAX + 1,
-  LANG
-};
+  if (strcmp (target, "/") == 0)
+    return "en";
 
+  if (strncmp (target, "/?", 2) != 0)
+    return NULL;
 
-void
-print_usage ()
-{
-  puts ("\n\
-  -h, --help                  show help for command line options\n\
-  -V, --version               show the program version number\n\
-      --lang=LANG             language (optional; defaults to 'en')\n\
-                              available: 'en','de','it','es'\n\
-  -l, --log                   log the output to a file (in addition to stdout)\n\
-      --input-file=FILE       Reads words from plain text file");
+  char *query = target + 2;
+  char *param = strstr (query, "lang=");
+  if (param != NULL && (param == query || param[-1] == '&'))
+    query = param + strlen ("lang=");
+
+  char *end = strchr (query, '&');
+  if (end != NULL)
+    *end = '\0';
+  return query;
 }
 
-static inline int
-write_log (wchar_t words[][BUFSIZ], wchar_t puzzle[][GRID_SIZE],
-           const long unsigned seed, const int n_string, struct lang_vars *st_lang_ptr)
+
+static void
+handle_client (const int client, struct lang_vars *st_langvars,
+               struct worker_state *worker, const struct word_source *source,
+               const struct puzzle_opts *opts)
 {
+  const struct timeval timeout = { 5, 0 };
+  setsockopt (client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+  // Only the request line is used, but read the whole header so the client
+  // doesn't get a reset when the connection is closed
+  char req[BUFSIZ];
+  size_t req_len = 0;
+  while (req_len < sizeof req - 1)
   {
-    char log_file[BUFSIZ];
-    snprintf (log_file, BUFSIZ, "aawordsearch_%lu.log", seed);
-    FILE *fp = fopen (log_file, "w");
-    if (fp != NULL)
-    {
-      fprintf (fp, "seed = %lu\n\n", seed);
-      print_answer_key (fp, puzzle);
-      print_puzzle (fp, puzzle, st_lang_ptr);
-      print_words (fp, words, n_string);
-    }
+    const ssize_t bytes = recv (client, req + req_len, sizeof req - 1 - req_len, 0);
+    if (bytes <= 0)
+      break;
+    req_len += bytes;
+    req[req_len] = '\0';
+    if (strstr (req, "\r\n\r\n") != NULL || strstr (req, "\n\n") != NULL)
+      break;
+  }
+  req[req_len] = '\0';
+
+  FILE *stream = fdopen (client, "w");
+  if (stream == NULL)
+  {
+    close (client);
+    return;
+  }
+
+  char *target = NULL;
+  char *method = strtok_r (req, " ", &target);
+  target = method != NULL ? strtok_r (NULL, " \r\n", &target) : NULL;
+
+  const char *lang = NULL;
+  if (method == NULL || target == NULL)
+    send_response (stream, "400 Bad Request", "Bad Request\n", 12);
+  else if (strcmp (method, "GET") != 0)
+    send_response (stream, "405 Method Not Allowed", "Method Not Allowed\n", 19);
+  else if ((lang = parse_target (target)) == NULL)
+    send_response (stream, "404 Not Found", "Not Found\n", 10);
+  else
+  {
+    const bool all_langs = strcmp (lang, LANG_ALL) == 0;
+    struct lang_vars *st_lang_ptr =
+      all_langs ? st_langvars : get_lang_vars (st_langvars, lang);
+    if (st_lang_ptr == NULL)
+      send_response (stream, "400 Bad Request", "Invalid lang provided\n", 22);
     else
     {
-      fputs ("Error while opening ", stderr);
-      perror (log_file);
-      return -1;
+      char *page;
+      const size_t page_len =
+        build_page (&page, worker, st_langvars, st_lang_ptr - st_langvars,
+                    all_langs ? count_langs (st_langvars) : 1, source, opts);
+      if (page != NULL)
+        send_response (stream, "200 OK", page, page_len);
+      else
+        send_response (stream, "503 Service Unavailable",
+                       "Unable to generate a puzzle\n", 28);
+      free (page);
     }
+  }
 
-    if (fclose (fp) != 0)
-      fprintf (stderr, "Error closing %s\n", log_file);
+  fclose (stream);
+  return;
+}
 
-    char word_log_file[BUFSIZ];
-    snprintf (word_log_file, BUFSIZ, "aawordsearch_words_%lu.log", seed);
-    fp = fopen (word_log_file, "w");
-    if (fp != NULL)
+
+static void
+serve_worker (const int listener, struct lang_vars *st_langvars,
+              const struct word_source *source, const struct puzzle_opts *opts)
+{
+  signal (SIGPIPE, SIG_IGN);
+
+  const int n_langs = count_langs (st_langvars);
+
+  // Every worker gets its own seed, even though they were all started at
+  // the same time
+  struct worker_state worker = { 0 };
+  rng_seed (&worker.rng, make_seed ());
+  fetcher_init (&worker.fetcher, 0);
+  worker.pools = calloc (n_langs, sizeof *worker.pools);
+  fail (worker.pools == NULL, "Error allocating memory\n");
+  fail (grid_alloc (&worker.puzzle, opts->rows, opts->cols) != 0
+        || (opts->placement == PLACE_BITBOARD
+            && grid_alloc_bitboard (&worker.puzzle) != 0),
+        "Error allocating memory\n");
+  const int max_words_target = get_max_words_target (&worker.puzzle);
+  const int max_list_size = max_words_target * 2;
+  if (source->file_words == NULL && source_fetches (source))
+  {
+    worker.prefetch = malloc (sizeof *worker.prefetch);
+    fail (worker.prefetch == NULL, "Error allocating memory\n");
+    prefetch_start (worker.prefetch, source->fetch, st_langvars,
+                    max_words_target * 1.2, get_max_len (&worker.puzzle));
+  }
+  int l;
+  for (l = 0; l < n_langs; l++)
+  {
+    struct word_pool *pool = &worker.pools[l];
+    int i;
+    pool->order = malloc (max_list_size * sizeof *pool->order);
+    fail (pool->order == NULL, "Error allocating memory\n");
+    for (i = 0; i < max_list_size; i++)
+      pool->order[i] = i;
+  }
+
+  while (1)
+  {
+    const int client = accept (listener, NULL, NULL);
+    if (client < 0)
     {
-      int l = 0;
-      while (l < n_string)
-      {
-        fprintf (fp, "%ls\n", words[l]);
-        l++;
-      }
+      if (errno != EINTR && errno != ECONNABORTED)
+        fprintf (stderr, "accept: %s\n", strerror (errno));
+      continue;
     }
-    if (fclose (fp) != 0)
-      fprintf (stderr, "Error closing %s\n", log_file);
+    handle_client (client, st_langvars, &worker, source, opts);
   }
-  return 0;
 }
 
 
-#ifndef TEST
 /*!
- * Removes trailing white space from a string (including newlines, formfeeds,
- * tabs, etc
- * @param[out] str The string to be altered
- * @return void
+ * Listens on port and hands the connections to a fixed number of worker
+ * processes. Each worker keeps its word lists between requests. If a worker
+ * dies, it gets replaced.
+ * @return only returns if setting up the listening socket failed
  */
-static void
-trim_whitespace (wchar_t *str)
+static int
+serve (const int port, const int n_workers, struct lang_vars *st_langvars,
+       const struct word_source *source, const struct puzzle_opts *opts)
 {
-  if (str == NULL)
-    return;
-
-  wchar_t *pos_0 = str;
-  /* Advance pointer until NULL terminator is found */
-  while (*str != '\0')
-    str++;
+  const int listener = socket (AF_INET, SOCK_STREAM, 0);
+  if (listener < 0)
+  {
+    perror ("socket");
+    return -1;
+  }
 
-  /* set pointer to segment preceding NULL terminator */
-  if (str != pos_0)
-    str--;
-  else
-    return;
+  const int yes = 1;
+  setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
 
-  while (isspace (*str))
+  struct sockaddr_in addr;
+  memset (&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_ANY);
+  addr.sin_port = htons (port);
+  if (bind (listener, (struct sockaddr *) &addr, sizeof addr) != 0
+      || listen (listener, SOMAXCONN) != 0)
   {
-    *str = '\0';
-    if (str != pos_0)
-      str--;
-    else
-      break;
+    fprintf (stderr, "Unable to listen on port %d: %s\n", port, strerror (errno));
+    close (listener);
+    return -1;
   }
 
-  return;
+  printf ("Listening on port %d with %d workers\n", port, n_workers);
+  fflush (stdout);
+
+  int n_running = 0;
+  while (1)
+  {
+    while (n_running < n_workers)
+    {
+      const pid_t pid = fork ();
+      if (pid == 0)
+        serve_worker (listener, st_langvars, source, opts);
+      else if (pid < 0)
+      {
+        perror ("fork");
+        sleep (1);
+        break;
+      }
+      n_running++;
+    }
+
+    int status;
+    const pid_t pid = wait (&status);
+    if (pid > 0)
+    {
+      fprintf (stderr, "worker %d exited; starting a new one\n", (int) pid);
+      n_running--;
+    }
+    else if (errno == ECHILD)
+      n_running = 0;
+  }
 }
 
 
@@ -669,18 +5407,34 @@ int
 main (int argc, char **argv)
 {
   setlocale(LC_ALL, "");
-  const int max_words_target = GRID_SIZE;
-  const int fetch_count = max_words_target * 1.2;
-  // this probably means the word server is having issues. If this number is exceeded,
-  // we'll quit completely
-  const int max_tot_err_allowed = 10;
-  const int max_tries_per_direction = GRID_SIZE * 5;
-  wchar_t puzzle[GRID_SIZE][GRID_SIZE];
+  fits_run_init ();
+#ifdef HAVE_CURL
+  // This isn't thread-safe, so it's done before any threads (or server
+  // workers) are started
+  curl_global_init (CURL_GLOBAL_DEFAULT);
+  atexit (curl_global_cleanup);
+  // atexit() functions run last first, so this comes before the cleanup
+  atexit (wait_race_threads);
+#endif
+  struct puzzle_opts opts = {
+    GRID_SIZE, GRID_SIZE, PLACE_RANDOM, false, ORDER_GIVEN, DENSE_NODES
+  };
+  int count = 1;
+  int port = 0;
+  int n_workers = 4;
+  int n_jobs = 1;
+  uint64_t seed = make_seed ();
 
   bool want_log = false;
   char *word_file_path = NULL;
+  char *dict_path = NULL;
+  char *solve_path = NULL;
   char *lang = NULL;
   char *lang_en = "en";
+  // --host replaces HOST
+  const char *hosts[MAX_HOSTS + 1] = { NULL };
+  int n_hosts = 0;
+  struct fetch_opts fetch = { HOST, 0 };
 
   const struct option long_options[] = {
     {"help", no_argument, NULL, 'h'},
@@ -688,6 +5442,21 @@ main (int argc, char **argv)
     {"version", no_argument, NULL, 'V'},
     {"input-file", required_argument, NULL, INPUT_FILE},
     {"lang", required_argument, NULL, LANG},
+    {"count", required_argument, NULL, COUNT},
+    {"serve", required_argument, NULL, SERVE},
+    {"workers", required_argument, NULL, WORKERS},
+    {"dict", required_argument, NULL, DICT},
+    {"rows", required_argument, NULL, ROWS},
+    {"cols", required_argument, NULL, COLS},
+    {"placement", required_argument, NULL, PLACEMENT},
+    {"seed", required_argument, NULL, SEED},
+    {"jobs", required_argument, NULL, JOBS},
+    {"solve", required_argument, NULL, SOLVE},
+    {"unique", no_argument, NULL, UNIQUE},
+    {"order", required_argument, NULL, ORDER},
+    {"dense", optional_argument, NULL, DENSE},
+    {"host", required_argument, NULL, WORD_HOST},
+    {"fetch-deadline", required_argument, NULL, FETCH_DEADLINE},
     {0, 0, 0, 0}
   };
 
@@ -704,12 +5473,100 @@ main (int argc, char **argv)
       want_log = true;
       puts ("The log will be activated! Hooray!");
       break;
-    case INPUT_FILE:
-      word_file_path = optarg;
+    case INPUT_FILE:
+      word_file_path = optarg;
+      break;
+    case LANG:
+      lang = optarg;
+      break;
+    case DICT:
+      dict_path = optarg;
+      break;
+    case SOLVE:
+      solve_path = optarg;
+      break;
+    case UNIQUE:
+      opts.unique = true;
+      break;
+    case COUNT:
+      if (get_int_arg (&count, optarg, 1, INT_MAX, "count") != 0)
+        return -1;
+      break;
+    case SERVE:
+      if (get_int_arg (&port, optarg, 1, 65535, "port") != 0)
+        return -1;
+      break;
+    case WORKERS:
+      if (get_int_arg (&n_workers, optarg, 1, 1024, "number of workers") != 0)
+        return -1;
+      break;
+    case ROWS:
+      if (get_int_arg (&opts.rows, optarg, MIN_GRID_SIZE, MAX_GRID_SIZE, "number of rows") != 0)
+        return -1;
+      break;
+    case COLS:
+      if (get_int_arg (&opts.cols, optarg, MIN_GRID_SIZE, MAX_GRID_SIZE, "number of columns") != 0)
+        return -1;
+      break;
+    case PLACEMENT:
+      if (strcmp (optarg, "random") == 0)
+        opts.placement = PLACE_RANDOM;
+      else if (strcmp (optarg, "exhaustive") == 0)
+        opts.placement = PLACE_EXHAUSTIVE;
+      else if (strcmp (optarg, "bitboard") == 0)
+        opts.placement = PLACE_BITBOARD;
+      else
+      {
+        fprintf (stderr, "Invalid placement: '%s'\n", optarg);
+        return -1;
+      }
       break;
-    case LANG:
-      lang = optarg;
+    case WORD_HOST:
+      if (n_hosts == MAX_HOSTS)
+      {
+        fprintf (stderr, "At most %d hosts can be given\n", MAX_HOSTS);
+        return -1;
+      }
+      hosts[n_hosts++] = optarg;
+      fetch.hosts = hosts;
+      break;
+    case FETCH_DEADLINE:
+      if (get_int_arg (&fetch.deadline_ms, optarg, 1, INT_MAX, "deadline") != 0)
+        return -1;
+      break;
+    case DENSE:
+      opts.placement = PLACE_DENSE;
+      if (optarg != NULL
+          && get_int_arg (&opts.dense_nodes, optarg, 1, INT_MAX, "search budget") != 0)
+        return -1;
+      break;
+    case ORDER:
+      if (strcmp (optarg, "given") == 0)
+        opts.order = ORDER_GIVEN;
+      else if (strcmp (optarg, "longest") == 0)
+        opts.order = ORDER_LONGEST;
+      else
+      {
+        fprintf (stderr, "Invalid order: '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    case JOBS:
+      if (get_int_arg (&n_jobs, optarg, 1, 1024, "number of jobs") != 0)
+        return -1;
       break;
+    case SEED:
+    {
+      char *endptr;
+      errno = 0;
+      seed = strtoull (optarg, &endptr, 0);
+      if (errno != 0 || endptr == optarg || *endptr != '\0' || *optarg == '-')
+      {
+        fprintf (stderr, "Invalid seed: '%s'\n", optarg);
+        return -1;
+      }
+      break;
+    }
     case 'V':
       // printf ("%s v%s\n\n", PROGRAM_NAME, VERSION);
       puts (PROGRAM_NAME " " VERSION "\n");
@@ -722,6 +5579,15 @@ main (int argc, char **argv)
     }
   }
 
+  if (solve_path != NULL)
+    return solve (solve_path);
+
+  // each thread (or server worker) allocates its own grid; only the size
+  // is needed here
+  const struct grid size = { .rows = opts.rows, .cols = opts.cols };
+  const int max_words_target = get_max_words_target (&size);
+  const int fetch_count = max_words_target * 1.2;
+
   /* Print any remaining command line arguments (not options). */
   if (optind < argc)
   {
@@ -731,184 +5597,122 @@ main (int argc, char **argv)
     putchar ('\n');
   }
 
-  wchar_t fetched_words[GRID_SIZE * 2][BUFSIZ];
-  int max_list_size = sizeof fetched_words / sizeof fetched_words[0];
+  struct word_list fetched_words = { 0 };
+  const int max_list_size = max_words_target * 2;
 
   if (word_file_path != NULL)
   {
-    FILE* fp = fopen(word_file_path, "r");
-    if (fp == NULL) {
-      fputs ("error opening word file: ", stderr);
-      perror (word_file_path);
+    // a stream of its own, so the sample doesn't follow the puzzles'
+    // random numbers
+    struct rng rng;
+    rng_seed_stream (&rng, seed, UINT64_MAX);
+    if (read_word_file (word_file_path, &fetched_words, max_list_size,
+                        get_max_len (&size), &rng) < 0)
       return -1;
-    }
-
-    int cur_word = 0;
-    while (cur_word < max_list_size && fgetws (fetched_words[cur_word], sizeof fetched_words[0], fp) != NULL )
-    {
-      trim_whitespace (fetched_words[cur_word]);
-      wchar_t *ptr = wcschr(fetched_words[cur_word], ' ');
-      wchar_t *ptr2 = wcschr(fetched_words[cur_word], '.');
-      if (*fetched_words[cur_word] == '\0' || ptr != NULL || ptr2 != NULL)
-        continue;
-      cur_word++;
-    }
 
-    if (cur_word < max_words_target)
+    if (fetched_words.n < max_words_target)
     {
       fprintf(stderr, "Your word list must contain at least %d words.\n", max_words_target);
       return -1;
     }
-
-    if (fclose(fp) != 0)
-    {
-      fputs ("Error closing file:", stderr);
-      perror (word_file_path);
-      // errno is a global that's included with errno.h. Many common std
-      // functions set it after they're called.
-      return errno;
-    }
   }
 
-  init_puzzle (puzzle);
-
   if (lang == NULL)
     lang = lang_en;
 
   struct lang_vars st_langvars[] = {
-    {"en", "en_US", en_alphabet, wcslen(en_alphabet)},
-    {"de", "de_DE.UTF-8", de_alphabet, wcslen(de_alphabet)},
-    {"it", "it_IT.UTF-8", it_alphabet, wcslen(it_alphabet)},
-    {"es", "es_ES.UTF-8", es_alphabet, wcslen(es_alphabet)},
-    {NULL, NULL, NULL, 0}
+    { .lang = "en", .alphabet = en_alphabet, .length = wcslen (en_alphabet) },
+    { .lang = "de", .alphabet = de_alphabet, .length = wcslen (de_alphabet) },
+    { .lang = "it", .alphabet = it_alphabet, .length = wcslen (it_alphabet) },
+    { .lang = "es", .alphabet = es_alphabet, .length = wcslen (es_alphabet) },
+    { .lang = NULL }
   };
+  int l;
+  for (l = 0; st_langvars[l].lang != NULL; l++)
+    lang_init (&st_langvars[l]);
 
-  struct lang_vars *st_lang_ptr = st_langvars;
-  while (st_lang_ptr->lang != NULL)
-  {
-    if (strcmp (lang, st_lang_ptr->lang) == 0)
-      break;
-    st_lang_ptr++;
-  }
+  struct dict dict;
+  if (dict_path != NULL && dict_open (&dict, dict_path, st_langvars) != 0)
+    return -1;
 
-  if (st_lang_ptr->lang == NULL)
+  const struct word_source source = {
+    word_file_path != NULL ? &fetched_words : NULL,
+    dict_path != NULL ? &dict : NULL,
+    &fetch
+  };
+  if (port != 0)
+    return serve (port, n_workers, st_langvars, &source, &opts);
+
+  // with --lang=all, every language gets its own words and puzzles; they're
+  // all fetched and generated at the same time
+  const bool all_langs = strcmp (lang, LANG_ALL) == 0;
+  struct lang_vars *st_lang_ptr =
+    all_langs ? st_langvars : get_lang_vars (st_langvars, lang);
+  if (st_lang_ptr == NULL)
   {
     fputs("Invalid lang provided", stderr);
     return -1;
   }
+  const int n_langs = all_langs ? count_langs (st_langvars) : 1;
 
-  setlocale(LC_ALL, st_lang_ptr->locale);
-
-  /* seed the random number generator */
-  const time_t seed = time (NULL);
-  srand (seed);
-  int n_tot_err = 0;
-
-  if (word_file_path == NULL)
+  struct fetch_job *fetches = calloc (n_langs, sizeof *fetches);
+  struct job_params *params = calloc (n_langs, sizeof *params);
+  fail (fetches == NULL || params == NULL, "Error allocating memory\n");
+  int r = 0;
+  for (l = 0; l < n_langs; l++)
   {
-    const char **host_ptr = HOST;
-    int r = -1;
-    while (*host_ptr != NULL && r != 0)
+    fetches[l].fetch = &fetch;
+    fetches[l].lang = st_lang_ptr[l].lang;
+    fetches[l].fetch_count = fetch_count;
+    fetches[l].max_len = get_max_len (&size);
+    if (dict_path != NULL
+        && dict_n_words (&dict, st_lang_ptr - st_langvars + l, get_max_len (&size)) == 0)
     {
-      int strikes = 0;
-      do
-      {
-        r = get_words (fetched_words, fetch_count, st_lang_ptr->lang, *host_ptr);
-        if (r != 0)
-          n_tot_err++;
-      }
-      while (++strikes < 3 && r == -1);
-
-      if (r != 0)
-        fputs ("Failed to get words from server\n", stderr);
-
-      host_ptr++;
+      fprintf (stderr, "No '%s' words in the dictionary\n", st_lang_ptr[l].lang);
+      r = -1;
     }
-    if (r != 0)
-      return -1;
   }
-
-  int i;
-  wchar_t words[GRID_SIZE * 2][BUFSIZ];
-  for (i = 0; i < max_words_target; i++)
+  const bool fetching = word_file_path == NULL && source_fetches (&source);
+  if (r == 0 && fetching)
   {
-    *words[i] = '\0';
+    r = fetch_all_words (fetches, n_langs);
+    // with --fetch-deadline, the languages no host answered for in time get
+    // their words from the dictionary
+    if (dict_path != NULL)
+      r = 0;
   }
 
-  dir_op *dir_op = create_dir_op ();
-  int n_string = 0, f_string = 0;
-  int cur_dir = 0;
-  while ((n_string < max_words_target) && n_tot_err < max_tot_err_allowed)
+  for (l = 0; l < n_langs; l++)
   {
-    size_t len = wcslen (fetched_words[f_string]);
-    if (len > (size_t)MAX_LEN)          // skip the word if it exceeds this value
-    {
-      printf ("word '%ls' exceeded max length\n", fetched_words[f_string]);
-      f_string++;
-      continue;
-    }
-
-    wchar_t *ptr = wcschr(fetched_words[f_string], ' ');
-    wchar_t *ptr2 = wcschr(fetched_words[f_string], '.');
-    if (ptr != NULL || ptr2 != NULL)
-    {
-      printf ("Skipping '%ls'\n", fetched_words[f_string]);
-      f_string++;
-      continue;
-    }
-
-    wcscpy (words[n_string], fetched_words[f_string]);
-    printf ("%d.) %ls\n", n_string + 1, words[n_string]);
-
-    // Try placing the word in all 8 directions, each direction at most
-    // max_tries_per_direction. If successful, break from both loops and get
-    // the next word.
-    int d, r;
-    for (d = 0; d < N_DIRECTIONS; d++)
-    {
-      int ctr;
-      for (ctr = 0; ctr < max_tries_per_direction; ctr++)
-      {
-        dir_op[cur_dir].begin_row =
-          op[get_row_op (dir_op[cur_dir].row)] (len);
-        dir_op[cur_dir].begin_col =
-          op[get_col_op (dir_op[cur_dir].col)] (len);
-        r = placer (&dir_op[cur_dir], words[n_string], puzzle);
-        if (!r)
-          break;
-      }
-      cur_dir == N_DIRECTIONS - 1 ? cur_dir = 0 : cur_dir++;
-      if (!r)
-      {
-        n_string++;
-        f_string++;
-        break;
-      }
-    }
-    if (r)
-    {
-      n_tot_err++;
-      printf ("Unable to find a place for '%ls'\n", words[n_string]);
-      f_string++;
-    }
-
-    if (n_tot_err >= max_tot_err_allowed)
-    {
-      fprintf (stderr, "Too many errors (%d); giving up\n", n_tot_err);
-      return -1;
-    }
+    const bool use_dict =
+      dict_path != NULL && (!fetching || fetches[l].status < 0);
+    if (use_dict && fetching)
+      fprintf (stderr, "Using the words in %s for '%s'\n", dict_path,
+               st_lang_ptr[l].lang);
+    params[l].st_lang_ptr = &st_lang_ptr[l];
+    params[l].lang_no = st_lang_ptr - st_langvars + l;
+    params[l].words = use_dict ? NULL :
+      word_file_path != NULL ? &fetched_words : &fetches[l].words;
+    params[l].dict = use_dict ? &dict : NULL;
+    params[l].opts = &opts;
+    params[l].seed = seed;
+    params[l].count = count;
+    params[l].want_log = want_log;
+    params[l].log_lang = all_langs ? st_lang_ptr[l].lang : NULL;
+    params[l].n_tot_err = fetches[l].n_tot_err;
   }
-
-  print_answer_key (stdout, puzzle);
-  print_puzzle (stdout, puzzle, st_lang_ptr);
-  print_words (stdout, words, n_string);
-
-  // write the seed, answer key, and puzzle to a file
-  if (want_log)
-    if (write_log (words, puzzle, seed, n_string, st_lang_ptr) != 0)
-      return -1;
-
-  return 0;
+  if (r == 0)
+    r = run_jobs (params, n_langs, n_jobs);
+
+  if (dict_path != NULL)
+    dict_close (&dict);
+  word_list_free (&fetched_words);
+  for (l = 0; l < n_langs; l++)
+    word_list_free (&fetches[l].words);
+  free (fetches);
+  free (params);
+
+  return r;
 }
 #else
 
@@ -980,55 +5784,94 @@ test_dir_ops (dir_op * dir_op)
 }
 
 
+/* each direction kernel has to write the letters of a word the way the
+direction's constants (checked in test_dir_ops) say */
+void
+test_direction_kernels (dir_op * dir_op)
+{
+  struct rng rng;
+  rng_seed (&rng, 1);
+  struct grid puzzle;
+  assert (grid_alloc (&puzzle, 10, 12) == 0);
+  struct lang_vars st_lang = { .lang = "en", .alphabet = en_alphabet, .length = wcslen (en_alphabet) };
+  lang_init (&st_lang);
+  grid_set_alphabet (&puzzle, &st_lang);
+  uint8_t word[3];
+  assert (grid_encode (&puzzle, L"ABC", 3, word) == 0);
+
+  int i;
+  for (i = 0; i < N_DIRECTIONS; i++)
+  {
+    init_puzzle (&puzzle);
+    assert (place_random[i] (word, 3, &puzzle, &rng) == 0);
+    int row, col, n_found = 0;
+    for (row = 0; row < puzzle.rows; row++)
+      for (col = 0; col < puzzle.cols; col++)
+        if (CELL (&puzzle, row, col) == word[0])
+        {
+          n_found++;
+          assert (CELL (&puzzle, row + dir_op[i].row, col + dir_op[i].col) == word[1]);
+          assert (CELL (&puzzle, row + 2 * dir_op[i].row, col + 2 * dir_op[i].col) == word[2]);
+        }
+    assert (n_found == 1);
+  }
+
+  grid_free (&puzzle);
+  return;
+}
+
+
 /* loop through each direction 50? times to make sure that the random numbers
 generated don't exceed the desired values */
 void
-test_starting_points (dir_op * dir_op, const int len)
+test_starting_points (dir_op * dir_op, const int len, const int rows, const int cols)
 {
+  struct rng rng;
+  rng_seed (&rng, 1);
   int i, j;
   int row, col;
   for (i = 0; i < N_DIRECTIONS; i++)
   {
     fprintf (stderr, "i:%d\n", i);
-    for (j = 0; j < GRID_SIZE * 5; j++)
+    for (j = 0; j < MAX_TRIES_PER_DIRECTION; j++)
     {
-      row = op[get_row_op (dir_op[i].row)] (len);
-      col = op[get_col_op (dir_op[i].col)] (len);
+      row = start_point (dir_op[i].row, len, rows, &rng);
+      col = start_point (dir_op[i].col, len, cols, &rng);
       // fprintf (stderr, "%d", row);
       // fprintf (stderr, "%d", col);
       switch (i)
       {
       case HORIZONTAL:
-        assert (row >= 0 && row < GRID_SIZE);
-        assert (col >= 0 && col < GRID_SIZE - len);
+        assert (row >= 0 && row < rows);
+        assert (col >= 0 && col < cols - len);
         break;
       case HORIZONTAL_BACKWARD:
-        assert (row >= 0 && row < GRID_SIZE);
-        assert (col >= len && col < GRID_SIZE);
+        assert (row >= 0 && row < rows);
+        assert (col >= len && col < cols);
         break;
       case VERTICAL:
-        assert (row >= 0 && row < GRID_SIZE - len);
-        assert (col >= 0 && col < GRID_SIZE);
+        assert (row >= 0 && row < rows - len);
+        assert (col >= 0 && col < cols);
         break;
       case VERTICAL_UP:
-        assert (row >= 0 && row < GRID_SIZE);
-        assert (row >= len && row < GRID_SIZE);
+        assert (row >= 0 && row < rows);
+        assert (row >= len && row < rows);
         break;
       case DIAGONAL_DOWN_RIGHT:
-        assert (row >= 0 && row < GRID_SIZE - len);
-        assert (col >= 0 && col < GRID_SIZE - len);
+        assert (row >= 0 && row < rows - len);
+        assert (col >= 0 && col < cols - len);
         break;
       case DIAGONAL_DOWN_LEFT:
-        assert (row >= 0 && row < GRID_SIZE - len);
-        assert (col >= len && col < GRID_SIZE);
+        assert (row >= 0 && row < rows - len);
+        assert (col >= len && col < cols);
         break;
       case DIAGONAL_UP_RIGHT:
-        assert (row >= 0 && row < GRID_SIZE);
-        assert (col >= 0 && col < GRID_SIZE - len);
+        assert (row >= 0 && row < rows);
+        assert (col >= 0 && col < cols - len);
         break;
       case DIAGONAL_UP_LEFT:
-        assert (row >= 0 && row < GRID_SIZE);
-        assert (col >= len && col < GRID_SIZE);
+        assert (row >= 0 && row < rows);
+        assert (col >= len && col < cols);
         break;
       }
     }
@@ -1037,14 +5880,657 @@ test_starting_points (dir_op * dir_op, const int len)
 }
 
 
+/* the same seed must give the same numbers, and rng_below() must stay below
+its bound */
+void
+test_rng (void)
+{
+  struct rng a, b;
+  rng_seed (&a, 42);
+  rng_seed (&b, 42);
+  int i;
+  for (i = 0; i < 1000; i++)
+    assert (rng_next (&a) == rng_next (&b));
+
+  rng_seed (&b, 43);
+  assert (rng_next (&a) != rng_next (&b));
+
+  rng_seed_stream (&a, 42, 1);
+  rng_seed_stream (&b, 42, 1);
+  assert (rng_next (&a) == rng_next (&b));
+  rng_seed_stream (&b, 42, 2);
+  assert (rng_next (&a) != rng_next (&b));
+
+  const uint64_t bounds[] = { 1, 2, 3, 7, 100, 0x80000001 };
+  size_t j;
+  for (j = 0; j < sizeof bounds / sizeof bounds[0]; j++)
+    for (i = 0; i < 1000; i++)
+      assert (rng_below (&a, bounds[j]) < bounds[j]);
+  return;
+}
+
+
+/* a thread takes its own batches from the front, then steals from the back
+of the other queues; every batch must be handed out exactly once */
+void
+test_job_queues (const int n_queues, const int n_batches)
+{
+  struct job_queue *queues = malloc (n_queues * sizeof *queues);
+  int *taken = calloc (n_batches, sizeof *taken);
+  assert (queues != NULL && taken != NULL);
+  job_queues_init (queues, n_queues, n_batches);
+
+  int prev = -1;
+  int batch;
+  while ((batch = job_queue_take (queues, n_queues, 0)) >= 0)
+  {
+    assert (batch < n_batches);
+    if (batch % n_queues == 0)
+      assert (batch > prev);
+    else
+      assert (prev % n_queues != batch % n_queues || batch < prev);
+    taken[batch]++;
+    prev = batch;
+  }
+  int i;
+  for (i = 0; i < n_batches; i++)
+    assert (taken[i] == 1);
+
+  job_queues_destroy (queues, n_queues);
+  free (queues);
+  free (taken);
+  return;
+}
+
+
+/* the answer key shows the empty cells as fill_char; the puzzle shows the
+letters picked by fill_puzzle(), which leaves the other cells alone */
+void
+test_render (void)
+{
+  char out[4];
+  assert (utf8_encode (out, L'A') == 1 && out[0] == 'A');
+  assert (utf8_encode (out, L'Ñ') == 2 && memcmp (out, "\xC3\x91", 2) == 0);
+  assert (utf8_encode (out, L'€') == 3 && memcmp (out, "\xE2\x82\xAC", 3) == 0);
+
+  // A and É aren't in the alphabet, so they're added to the symbols
+  struct lang_vars st_lang = { .lang = "es", .alphabet = L"Ñ", .length = 1 };
+  lang_init (&st_lang);
+  struct grid puzzle;
+  assert (grid_alloc (&puzzle, 2, 2) == 0);
+  grid_set_alphabet (&puzzle, &st_lang);
+  init_puzzle (&puzzle);
+  assert (grid_encode (&puzzle, L"A", 1, &CELL (&puzzle, 0, 0)) == 0);
+  assert (grid_encode (&puzzle, L"É", 1, &CELL (&puzzle, 1, 1)) == 0);
+  assert (puzzle.n_symbols == 3 && CELL (&puzzle, 1, 1) == 2);
+  struct rng rng;
+  rng_seed (&rng, 1);
+  fill_puzzle (&puzzle, &rng);
+  struct out_buf buf = { 0 };
+  render_grid (&buf, &puzzle, puzzle.cells);
+  render_grid (&buf, &puzzle, puzzle.filled);
+  const char expected[] = "A - \n- É \nA Ñ \nÑ É \n";
+  assert (buf.len == sizeof expected - 1);
+  assert (memcmp (buf.data, expected, buf.len) == 0);
+  out_buf_free (&buf);
+  grid_free (&puzzle);
+
+  // every empty cell gets a letter of the alphabet, also past FILL_BLOCK
+  assert (grid_alloc (&puzzle, 3, FILL_BLOCK + 3) == 0);
+  struct lang_vars st_lang_en = { .lang = "en", .alphabet = en_alphabet, .length = wcslen (en_alphabet) };
+  lang_init (&st_lang_en);
+  grid_set_alphabet (&puzzle, &st_lang_en);
+  init_puzzle (&puzzle);
+  assert (grid_encode (&puzzle, L"q", 1, &CELL (&puzzle, 1, FILL_BLOCK)) == 0);
+  assert (puzzle.n_symbols == puzzle.n_letters);
+  fill_puzzle (&puzzle, &rng);
+  int i, j;
+  for (i = 0; i < puzzle.rows; i++)
+    for (j = 0; j < puzzle.cols; j++)
+      if (i == 1 && j == FILL_BLOCK)
+        assert (puzzle.symbols[puzzle.filled[i * puzzle.stride + j]] == L'Q');
+      else
+        assert (puzzle.filled[i * puzzle.stride + j] < puzzle.n_letters);
+  grid_free (&puzzle);
+  return;
+}
+
+
+/* CAT is in the grid 4 times; ABA reads the same both ways, so each of its
+2 places is only found once, and so is the one letter word X */
+void
+test_find_words (dir_op * dir_op)
+{
+  const wchar_t *rows[] = { L"CATS", L"ABAX", L"TACO" };
+  struct grid puzzle;
+  assert (grid_alloc (&puzzle, 3, 4) == 0);
+  int i;
+  for (i = 0; i < 3; i++)
+    assert (grid_encode (&puzzle, rows[i], 4, &CELL (&puzzle, i, 0)) == 0);
+
+  struct word_list words = { 0 };
+  const wchar_t *list[] = { L"CAT", L"ABA", L"X", L"ZZ", L"CAT" };
+  for (i = 0; i < 5; i++)
+    word_list_add (&words, list[i], wcslen (list[i]));
+  struct matcher m;
+  matcher_build (&m, &words);
+  assert (m.word[m.word_state[4]] == 0);
+
+  struct match *matches = NULL;
+  int cap = 0;
+  const int n = find_words (&m, &words, &puzzle, puzzle.cells, dir_op, &matches, &cap);
+  assert (n == 7);
+  int count[5] = { 0 };
+  bool cat_up = false;
+  for (i = 0; i < n; i++)
+  {
+    count[matches[i].word]++;
+    if (matches[i].word == 0 && matches[i].row == 2 && matches[i].col == 2)
+      cat_up |= dir_op[matches[i].dir].row == -1 && dir_op[matches[i].dir].col == 0;
+  }
+  assert (count[0] == 4 && count[1] == 2 && count[2] == 1 && count[3] == 0);
+  assert (cat_up);
+
+  free (matches);
+  matcher_free (&m);
+  word_list_free (&words);
+  grid_free (&puzzle);
+  return;
+}
+
+
+/* with only 3 letters to fill the grid with, ABC turns up again all the
+time; afterwards it must only be where it was placed */
+void
+test_make_unique (dir_op * dir_op)
+{
+  struct lang_vars st_lang = { .lang = "en", .alphabet = L"ABC", .length = 3 };
+  lang_init (&st_lang);
+  struct grid puzzle;
+  assert (grid_alloc (&puzzle, 6, 6) == 0);
+  grid_set_alphabet (&puzzle, &st_lang);
+  init_puzzle (&puzzle);
+  assert (grid_encode (&puzzle, L"ABC", 3, &CELL (&puzzle, 2, 1)) == 0);
+  struct word_list words = { 0 }, upper = { 0 };
+  word_list_add (&words, L"abc", 3);
+  word_list_add (&upper, L"ABC", 3);
+  struct matcher m;
+  matcher_build (&m, &upper);
+  struct match *matches = NULL;
+  int cap = 0;
+
+  int seed;
+  for (seed = 0; seed < 20; seed++)
+  {
+    struct rng rng;
+    rng_seed (&rng, seed);
+    fill_puzzle (&puzzle, &rng);
+    assert (make_unique (&puzzle, &words, &rng) >= 0);
+    assert (find_words (&m, &upper, &puzzle, puzzle.filled, dir_op, &matches, &cap) == 1);
+    assert (matches[0].row == 2 && matches[0].col == 1 && matches[0].dir == 0);
+  }
+
+  free (matches);
+  matcher_free (&m);
+  word_list_free (&words);
+  word_list_free (&upper);
+  grid_free (&puzzle);
+  return;
+}
+
+
+/* add enough words to make both arrays grow a few times, then make sure
+each word can still be found */
+void
+test_word_list (void)
+{
+  struct word_list list = { 0 };
+  wchar_t word[BUFSIZ];
+  int i;
+  for (i = 0; i < 500; i++)
+  {
+    swprintf (word, BUFSIZ, L"word%d", i);
+    assert (word_list_add (&list, word, wcslen (word)) == i);
+  }
+  assert (list.n == 500);
+  for (i = 0; i < 500; i++)
+  {
+    swprintf (word, BUFSIZ, L"word%d", i);
+    assert (wcscmp (word_list_get (&list, i), word) == 0);
+    assert (word_list_len (&list, i) == wcslen (word));
+  }
+
+  word_list_clear (&list);
+  assert (list.n == 0);
+  word_list_add (&list, L"abcdef", 3);
+  assert (wcscmp (word_list_get (&list, 0), L"abc") == 0);
+
+  word_list_free (&list);
+  return;
+}
+
+
+/* the same response gives the same words however it's cut into pieces,
+and the words after max_words or longer than max_len are skipped */
+void
+test_json_words (void)
+{
+  const int max_len = 100;
+  char response[BUFSIZ];
+  char too_long[max_len + 2], longest[max_len + 1];
+  memset (too_long, 'x', sizeof too_long - 1);
+  too_long[sizeof too_long - 1] = '\0';
+  memset (longest, 'y', sizeof longest - 1);
+  longest[sizeof longest - 1] = '\0';
+  snprintf (response, sizeof response,
+            " [ \"hund\" ,\n\"%s\", \"gr\xc3\xbcn\",\"\\u00e9t\\u00E9\","
+            "\"\\ud83d\\ude00\", \"%s\", \"last\"]\n", too_long, longest);
+
+  struct word_list list = { 0 };
+  struct json_words p;
+  size_t piece;
+  for (piece = 1; piece <= strlen (response); piece++)
+  {
+    json_words_init (&p, &list, 5, max_len);
+    size_t i;
+    for (i = 0; i < strlen (response); i += piece)
+    {
+      const size_t left = strlen (response) - i;
+      json_words_feed (&p, response + i, left < piece ? left : piece);
+    }
+    assert (p.state == JSON_DONE);
+    assert (list.n == 5);
+    assert (wcscmp (word_list_get (&list, 0), L"hund") == 0);
+    assert (wcscmp (word_list_get (&list, 1), L"gr\u00fcn") == 0);
+    assert (wcscmp (word_list_get (&list, 2), L"\u00e9t\u00e9") == 0);
+    assert (wcscmp (word_list_get (&list, 3), L"\U0001F600") == 0);
+    assert (word_list_len (&list, 4) == (size_t) max_len);
+    json_words_free (&p);
+  }
+
+  const char *bad[] = { "[\"a\" \"b\"]", "[\"a\",]", "[\"\xc3\"]",
+    "[\"\\ud83d\"]", "[\"a\\q\"]", "[\"a\"] x", "[1]" };
+  size_t i;
+  for (i = 0; i < sizeof bad / sizeof *bad; i++)
+  {
+    json_words_init (&p, &list, 10, max_len);
+    json_words_feed (&p, bad[i], strlen (bad[i]));
+    assert (p.state == JSON_ERROR);
+    json_words_free (&p);
+  }
+
+  json_words_init (&p, &list, 10, max_len);
+  json_words_feed (&p, "[\"a\"", 4);
+  assert (p.state == JSON_NEXT);
+  json_words_free (&p);
+
+  word_list_free (&list);
+  return;
+}
+
+
+/* only the usable words are counted, the last line doesn't need a newline,
+and every word has a chance to be in the sample */
+void
+test_read_word_file (void)
+{
+  char path[] = "/tmp/aaws_test_XXXXXX";
+  const int fd = mkstemp (path);
+  assert (fd >= 0);
+  FILE *fp = fdopen (fd, "w");
+  assert (fp != NULL);
+  // 3 words that can't be used, then word0 ... word99
+  fputs ("too long for this\nhas space\ndot.\n\xc3\n", fp);
+  int i;
+  for (i = 0; i < 100; i++)
+    fprintf (fp, i < 99 ? "word%d \r\n" : "word%d", i);
+  fclose (fp);
+
+  struct word_list list = { 0 };
+  bool picked[100] = { false };
+  uint64_t seed;
+  for (seed = 0; seed < 50; seed++)
+  {
+    struct rng rng;
+    rng_seed (&rng, seed);
+    assert (read_word_file (path, &list, 10, 6, &rng) == 100);
+    assert (list.n == 10);
+    for (i = 0; i < list.n; i++)
+    {
+      int w;
+      assert (swscanf (word_list_get (&list, i), L"word%d", &w) == 1);
+      assert (w >= 0 && w < 100);
+      assert (word_list_len (&list, i) == (w < 10 ? 5u : 6u));
+      picked[w] = true;
+    }
+  }
+  // 50 samples of 10 words; a word is missed by all of them with a
+  // chance of 0.9^50, about 0.5%
+  int n_picked = 0;
+  for (i = 0; i < 100; i++)
+    n_picked += picked[i];
+  assert (n_picked > 90 && picked[0] && picked[99]);
+
+  struct rng rng;
+  rng_seed (&rng, 1);
+  assert (read_word_file (path, &list, 200, 6, &rng) == 100);
+  assert (list.n == 100);
+
+  unlink (path);
+  word_list_free (&list);
+  return;
+}
+
+
+#ifndef HAVE_CURL
+static void
+write_all (const int fd, const char *data)
+{
+  assert (write (fd, data, strlen (data)) == (ssize_t) strlen (data));
+  return;
+}
+
+
+/* responses with a Content-Length, in chunks (with extensions and a
+trailer) or ended by the server closing the connection are read up to their
+end, and the connection is only closed in the last case */
+void
+test_http_get (void)
+{
+  int sv[2];
+  assert (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  struct fetcher f;
+  fetcher_init (&f, 0);
+  f.fd = sv[0];
+  f.host = "localhost";
+  struct word_list list = { 0 };
+  struct json_words p;
+
+  // all at once, so each response has to stop where it ends
+  write_all (sv[1], "HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\n"
+             "[\"ab\",\"cd\"]"
+             "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+             "4;name=value\r\n[\"ef\r\n5\r\n\",\"gh\r\n2\r\n\"]\r\n"
+             "0\r\nX-Trailer: 1\r\n\r\n"
+             "HTTP/1.1 404 Not Found\r\nContent-Length: 4\r\n\r\nnope");
+  json_words_init (&p, &list, 10, 10);
+  assert (http_get (&f, "/", &p) == 200);
+  assert (p.state == JSON_DONE && list.n == 2);
+  assert (wcscmp (word_list_get (&list, 1), L"cd") == 0);
+
+  json_words_free (&p);
+  json_words_init (&p, &list, 10, 10);
+  assert (http_get (&f, "/", &p) == 200);
+  assert (p.state == JSON_DONE && list.n == 2);
+  assert (wcscmp (word_list_get (&list, 0), L"ef") == 0);
+  assert (wcscmp (word_list_get (&list, 1), L"gh") == 0);
+
+  json_words_free (&p);
+  json_words_init (&p, &list, 10, 10);
+  assert (http_get (&f, "/", &p) == 404);
+  assert (f.fd == sv[0] && f.in_len == 0);
+
+  // a length that's too long to be a list of words
+  write_all (sv[1], "HTTP/1.1 200 OK\r\nContent-Length: 99999999999\r\n\r\n");
+  json_words_free (&p);
+  json_words_init (&p, &list, 10, 10);
+  assert (http_get (&f, "/", &p) == -1);
+  fetcher_close (&f);
+  close (sv[1]);
+
+  // without a length, the body is everything up to the end of the connection
+  assert (socketpair (AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+  f.fd = sv[0];
+  f.host = "localhost";
+  write_all (sv[1], "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n[\"ij\"]");
+  shutdown (sv[1], SHUT_WR);
+  json_words_free (&p);
+  json_words_init (&p, &list, 10, 10);
+  assert (http_get (&f, "/", &p) == 200);
+  assert (p.state == JSON_DONE && list.n == 1);
+  assert (f.fd == -1);
+  close (sv[1]);
+
+  json_words_free (&p);
+  word_list_free (&list);
+  return;
+}
+#endif
+
+
+/* words that can't be placed are dropped, and the longest words come first,
+with words of the same length in the order they were given */
+void
+test_order_words (void)
+{
+  const wchar_t *in[] = {
+    L"ab", L"a.b", L"abcd", L"", L"abc", L"toolong", L"cd", L"a b", L"efgh"
+  };
+  const wchar_t *longest[] = { L"abcd", L"efgh", L"abc", L"ab", L"cd" };
+  struct word_list list = { 0 };
+  size_t i;
+  for (i = 0; i < sizeof in / sizeof *in; i++)
+    word_list_add (&list, in[i], wcslen (in[i]));
+  assert (word_list_filter (&list, 6) == 4);
+  assert (list.n == 5);
+
+  int order[5], given[5] = { 0, 1, 2, 3, 4 };
+  memcpy (order, given, sizeof order);
+  order_words (order, list.n, &list, 6, ORDER_GIVEN);
+  assert (memcmp (order, given, sizeof order) == 0);
+  order_words (order, list.n, &list, 6, ORDER_LONGEST);
+  for (i = 0; i < 5; i++)
+    assert (wcscmp (word_list_get (&list, order[i]), longest[i]) == 0);
+
+  word_list_free (&list);
+  return;
+}
+
+
+/* the vector versions of fits_run() have to agree with the scalar one for
+words of any length, in every direction */
+void
+test_fits_run (dir_op * dir_op)
+{
+#ifdef HAVE_SIMD_FITS
+  __builtin_cpu_init ();
+  const bool have_avx2 = __builtin_cpu_supports ("avx2");
+  const bool have_sse2 = __builtin_cpu_supports ("sse2");
+  struct rng rng;
+  rng_seed (&rng, 3);
+  struct grid puzzle;
+  assert (grid_alloc (&puzzle, 40, 40) == 0);
+  // the runs near the end of a row read past it, even past the last cell
+  size_t i;
+  for (i = 0; i < 40 * puzzle.stride + GRID_SLACK; i++)
+    puzzle.cells[i] = rng_below (&rng, 3) == 0 ? EMPTY_CELL : rng_below (&rng, 2);
+
+  uint8_t word[30];
+  int n, n_fits = 0;
+  for (n = 0; n < 20000; n++)
+  {
+    const size_t len = 1 + rng_below (&rng, 30);
+    size_t k;
+    for (k = 0; k < len; k++)
+      word[k] = rng_below (&rng, 2);
+    const struct dir_op *d = &dir_op[rng_below (&rng, N_DIRECTIONS)];
+    const ptrdiff_t step = d->row * (ptrdiff_t) puzzle.stride + d->col;
+    int first_row, last_row, first_col, last_col;
+    get_start_range (d->row, len, puzzle.rows, &first_row, &last_row);
+    get_start_range (d->col, len, puzzle.cols, &first_col, &last_col);
+    const int row = first_row + rng_below (&rng, last_row - first_row + 1);
+    const int col = first_col + rng_below (&rng, last_col - first_col + 1);
+    const uint8_t *cell = &CELL (&puzzle, row, col);
+    const uint32_t fits = fits_run_scalar (cell, step, word, len);
+    n_fits += fits != 0;
+    if (have_sse2)
+      assert (fits_run_sse2 (cell, step, word, len) == fits);
+    if (have_avx2)
+      assert (fits_run_avx2 (cell, step, word, len) == fits);
+  }
+  assert (n_fits > 1000);
+  grid_free (&puzzle);
+#else
+  (void) dir_op;
+#endif
+  return;
+}
+
+
+/* leave only one empty row (or column) in a small grid, so the only places
+a word fits are in that row, forward or backward */
+void
+test_place_exhaustive (dir_op * dir_op, const enum placement placement,
+                       const bool transpose)
+{
+  int (*place) (struct dir_op *, const uint8_t *, const size_t, struct grid *,
+                struct rng *) =
+    placement == PLACE_BITBOARD ? place_bitboard : place_exhaustive;
+  struct rng rng;
+  rng_seed (&rng, 1);
+  struct grid puzzle;
+  assert (grid_alloc (&puzzle, transpose ? 70 : 5, transpose ? 5 : 70) == 0);
+  if (placement == PLACE_BITBOARD)
+    assert (grid_alloc_bitboard (&puzzle) == 0);
+  struct lang_vars st_lang = { .lang = "en", .alphabet = en_alphabet, .length = wcslen (en_alphabet) };
+  lang_init (&st_lang);
+  grid_set_alphabet (&puzzle, &st_lang);
+  init_puzzle (&puzzle);
+  uint8_t q[3], xqx[3], word[70];
+  assert (grid_encode (&puzzle, L"QQQ", 3, q) == 0);
+  assert (grid_encode (&puzzle, L"XQX", 3, xqx) == 0);
+
+  // the bitboard is updated by placer, so fill the grid with it
+  int i, j;
+  for (i = 0; i < 70; i++)
+    for (j = 0; j < 5; j++)
+      if (j != 2)
+      {
+        dir_op[0].begin_row = transpose ? i : j;
+        dir_op[0].begin_col = transpose ? j : i;
+        assert (placer (&dir_op[0], q, 1, &puzzle) == 0);
+      }
+
+  const wchar_t *str = L"abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzabcdefghijklmnopq";
+  const int len = wcslen (str);
+  assert (grid_encode (&puzzle, str, len, word) == 0);
+  assert (place (dir_op, word, len, &puzzle, &rng) == 0);
+  const bool forward = CELL (&puzzle, transpose ? 0 : 2, transpose ? 2 : 0) == word[0]
+    || CELL (&puzzle, transpose ? 1 : 2, transpose ? 2 : 1) == word[0];
+  int n_letters = 0;
+  for (i = 0; i < 70; i++)
+  {
+    const uint8_t c = CELL (&puzzle, transpose ? i : 2, transpose ? 2 : i);
+    if (c != EMPTY_CELL)
+    {
+      assert (c == word[forward ? n_letters : len - 1 - n_letters]);
+      n_letters++;
+    }
+  }
+  assert (n_letters == len);
+
+  // only a word that matches existing letters fits now
+  assert (place (dir_op, xqx, 3, &puzzle, &rng) == -1);
+  assert (place (dir_op, q, 3, &puzzle, &rng) == 0);
+
+  grid_free (&puzzle);
+  return;
+}
+
+
+/* the rows and columns of a 3 x 3 grid only fit together one way (and its
+mirror images), which random choices without backtracking rarely find */
+void
+test_place_dense (dir_op * dir_op)
+{
+  const wchar_t *str[] = { L"ABC", L"DEF", L"GHI", L"ADG", L"BEH", L"CFI" };
+  const int n = sizeof str / sizeof *str;
+  struct grid puzzle;
+  assert (grid_alloc (&puzzle, 3, 3) == 0);
+  struct lang_vars st_lang = { .lang = "en", .alphabet = en_alphabet, .length = wcslen (en_alphabet) };
+  lang_init (&st_lang);
+  grid_set_alphabet (&puzzle, &st_lang);
+
+  uint8_t symbols[6][3];
+  const uint8_t *words[6];
+  size_t lens[6];
+  int i, placed[6];
+  bool out_of_nodes;
+  for (i = 0; i < n; i++)
+  {
+    assert (grid_encode (&puzzle, str[i], 3, symbols[i]) == 0);
+    words[i] = symbols[i];
+    lens[i] = 3;
+  }
+
+  uint64_t seed;
+  for (seed = 0; seed < 20; seed++)
+  {
+    struct rng rng;
+    rng_seed (&rng, seed);
+    init_puzzle (&puzzle);
+    assert (place_dense (dir_op, words, lens, n, n, 100000, &puzzle, &rng,
+                         placed, &out_of_nodes) == n);
+    assert (!out_of_nodes);
+    int row, col, n_empty = 0;
+    for (row = 0; row < 3; row++)
+      for (col = 0; col < 3; col++)
+        n_empty += CELL (&puzzle, row, col) == EMPTY_CELL;
+    assert (n_empty == 0);
+    for (i = 0; i < n; i++)
+      assert (placed[i] == i);
+
+    // with a budget of one node, only the first word is placed
+    init_puzzle (&puzzle);
+    assert (place_dense (dir_op, words, lens, n, n, 1, &puzzle, &rng,
+                         placed, &out_of_nodes) == 1);
+    assert (out_of_nodes);
+
+    // asking for more words than there are ends the search, not the budget
+    init_puzzle (&puzzle);
+    assert (place_dense (dir_op, words, lens, n, n + 1, 100000, &puzzle, &rng,
+                         placed, &out_of_nodes) == n);
+    assert (!out_of_nodes);
+  }
+
+  grid_free (&puzzle);
+  return;
+}
+
+
 int
 main (void)
 {
-  dir_op *dir_op = create_dir_op ();
+  dir_op dir_op[N_DIRECTIONS];
+  create_dir_op (dir_op);
 
   test_dir_ops (dir_op);
-  test_starting_points (dir_op, 5);
-  test_starting_points (dir_op, GRID_SIZE - 2);
+  test_direction_kernels (dir_op);
+  test_starting_points (dir_op, 5, GRID_SIZE, GRID_SIZE);
+  test_starting_points (dir_op, GRID_SIZE - 2, GRID_SIZE, GRID_SIZE);
+  test_starting_points (dir_op, 10, 12, 1000);
+  test_starting_points (dir_op, 998, 1000, 1000);
+  test_rng ();
+  test_render ();
+  test_find_words (dir_op);
+  test_make_unique (dir_op);
+  test_job_queues (1, 10);
+  test_job_queues (3, 10);
+  test_job_queues (4, 2);
+  test_word_list ();
+  test_json_words ();
+#ifndef HAVE_CURL
+  test_http_get ();
+#endif
+  test_order_words ();
+  test_read_word_file ();
+  test_fits_run (dir_op);
+  fits_run_init ();
+  test_place_exhaustive (dir_op, PLACE_EXHAUSTIVE, false);
+  test_place_exhaustive (dir_op, PLACE_EXHAUSTIVE, true);
+  test_place_exhaustive (dir_op, PLACE_BITBOARD, false);
+  test_place_exhaustive (dir_op, PLACE_BITBOARD, true);
+  test_place_dense (dir_op);
 
   return 0;
 }